@@ -1,14 +1,63 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdarg.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "codegeneration.h"
+#include "optimizer.h"
+
+#define CODE_BUFFER_SIZE (64 * 1024)
+#define INSTRUCTION_BLOCK 1024
+
+// The code of the current file is kept as instructions and printed once by StopCodeGeneration
+int codeFile = -1;
+Instruction* instructions = NULL;
+int instructionCount = 0;
+int instructionCapacity = 0;
+
+// Text of the current file, filled by the printer
+char* codeBuffer = NULL;
+size_t codeLength = 0;
+size_t codeCapacity = 0;
+
+// Function names referenced by function and call instructions, shared by all files
+FunctionName* functionNames = NULL;
+int functionNameCount = 0;
+int* functionNameTable = NULL;  // open addressing table of (name id + 1), 0 marks an empty slot
+int functionNameTableSize = 0;
+
+// Literals of the current file kept in static slots after the class statics, in slot order
+char** pooledStrings = NULL;
+int pooledStringCount = 0;
+int stringLabelCount = 0;
+
+// Files waiting for FinishCodeGeneration while dead functions are eliminated
+GeneratedFile* heldFiles = NULL;
+int heldFileCount = 0;
 
-FILE* codeFile = NULL;
 int whileCount = 0;
 int ifCount = 0;
 
+// Subroutine whose code is being generated
+SymbolId currentFunction = NO_SYMBOL;
+
+static char* opcodeNames[OP_COUNT] = {"push", "pop", "add", "sub", "neg", "eq", "gt", "lt", "and", "or", "not", "label", "goto", "if-goto", "function", "call", "return"};
+static char* segmentNames[SEG_COUNT] = {"", "constant", "argument", "local", "static", "this", "that", "pointer", "temp"};
+static char* labelNames[LABEL_COUNT] = {"WHILE_EXP", "WHILE_END", "IF_TRUE", "IF_FALSE", "IF_END", "STRING_READY", "WHILE_BODY", "AND_TRUE", "AND_END", "OR_TRUE", "OR_END", "INTRINSIC_TRUE", "INTRINSIC_END", "TAIL_CALL"};
+
+void AddInstruction(Opcode opcode, Segment segment, int index, int target);
+unsigned int HashFunctionName(char* className, char* functionName);
+void ReserveCode(size_t size);
+void AppendText(const char* text);
+void AppendNumber(int value);
+void PrintInstruction(Instruction* instruction);
+void PrintCode(Instruction* code, int count);
+void WriteCode(int file);
+void HoldCode();
+int GetPooledString(char* string);
+void EmitNewString(char* string);
+
 int InitCodeGeneration(char* filename)
 {
     // Change .jack extension to .vm
@@ -17,9 +66,12 @@ int InitCodeGeneration(char* filename)
     char *dot = strrchr(newFilename, '.');
     strcpy(dot, ".vm");
 
-    codeFile = fopen(newFilename, "w");
+    instructionCount = 0;
+    stringLabelCount = 0;
+
+    codeFile = open(newFilename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
 
-    if (codeFile == 0)
+    if (codeFile < 0)
     {
         printf("Error: can't open file\n");
         return 1;
@@ -28,122 +80,230 @@ int InitCodeGeneration(char* filename)
     return 0;
 }
 
-void EmitCode(const char *format, ...)
+void AddInstruction(Opcode opcode, Segment segment, int index, int target)
 {
-    va_list args;
-    va_start(args, format);
-    int result = vfprintf(codeFile, format, args);
-    va_end(args);
+    if (instructionCount == instructionCapacity)
+    {
+        instructionCapacity += instructionCapacity == 0 ? INSTRUCTION_BLOCK : instructionCapacity;
+        instructions = (Instruction*)realloc(instructions, sizeof(Instruction) * instructionCapacity);
 
-    if (result < 0) {
-        printf("Error writing to file: ");
-        if (ferror(codeFile)) {
-            perror("");
-        } else {
-            printf("Unknown error\n");
+        if (instructions == NULL)
+        {
+            printf("Error: out of memory for generated code\n");
+            exit(1);
         }
     }
+
+    Instruction* instruction = &instructions[instructionCount++];
+    instruction->opcode = (unsigned char)opcode;
+    instruction->segment = (unsigned char)segment;
+    instruction->index = index;
+    instruction->target = target;
+}
+
+/// @brief Returns the instructions generated for the current file so far.
+Instruction* GetInstructions(int* count)
+{
+    *count = instructionCount;
+    return instructions;
+}
+
+unsigned int HashFunctionName(char* className, char* functionName)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*className != '\0')
+    {
+        hash ^= (unsigned char)*className++;
+        hash *= 16777619u;
+    }
+
+    hash ^= '.';
+    hash *= 16777619u;
+
+    while (*functionName != '\0')
+    {
+        hash ^= (unsigned char)*functionName++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/// @brief Returns the id of Class.function, adding it the first time. The name strings are not copied.
+int GetFunctionNameId(char* className, char* functionName)
+{
+    unsigned int hash = HashFunctionName(className, functionName);
+
+    if ((functionNameCount + 1) * 2 > functionNameTableSize)
+    {
+        functionNameTableSize = functionNameTableSize == 0 ? 256 : functionNameTableSize * 2;
+        functionNameTable = (int*)realloc(functionNameTable, sizeof(int) * functionNameTableSize);
+        functionNames = (FunctionName*)realloc(functionNames, sizeof(FunctionName) * functionNameTableSize / 2);
+        memset(functionNameTable, 0, sizeof(int) * functionNameTableSize);
+
+        for (int i = 0; i < functionNameCount; i++)
+        {
+            unsigned int slot = functionNames[i].hash & (functionNameTableSize - 1);
+
+            while (functionNameTable[slot] != 0)
+                slot = (slot + 1) & (functionNameTableSize - 1);
+
+            functionNameTable[slot] = i + 1;
+        }
+    }
+
+    unsigned int mask = functionNameTableSize - 1;
+    unsigned int slot = hash & mask;
+
+    while (functionNameTable[slot] != 0)
+    {
+        FunctionName* name = &functionNames[functionNameTable[slot] - 1];
+
+        if (name->hash == hash && strcmp(name->className, className) == 0 && strcmp(name->functionName, functionName) == 0)
+            return functionNameTable[slot] - 1;
+
+        slot = (slot + 1) & mask;
+    }
+
+    FunctionName* name = &functionNames[functionNameCount];
+    name->className = className;
+    name->functionName = functionName;
+    name->hash = hash;
+    functionNameTable[slot] = functionNameCount + 1;
+
+    return functionNameCount++;
+}
+
+FunctionName* GetFunctionName(int nameId)
+{
+    return &functionNames[nameId];
+}
+
+int GetFunctionNameCount()
+{
+    return functionNameCount;
+}
+
+void EmitOperation(Opcode opcode)
+{
+    AddInstruction(opcode, SEG_NONE, 0, 0);
+}
+
+void EmitPushSegment(Segment segment, int index)
+{
+    AddInstruction(OP_PUSH, segment, index, 0);
+}
+
+void EmitPopSegment(Segment segment, int index)
+{
+    AddInstruction(OP_POP, segment, index, 0);
+}
+
+void EmitLabel(Opcode opcode, LabelKind label, int number)
+{
+    AddInstruction(opcode, SEG_NONE, number, label);
 }
 
 void EmitPushStatic(int index)
 {
-    EmitCode("push static %d\n", index);
+    EmitPushSegment(SEG_STATIC, index);
 }
 
 void EmitPushConstant(int value)
 {
-    EmitCode("push constant %d\n", value);
+    EmitPushSegment(SEG_CONSTANT, value);
 }
 
 void EmitPushLocal(int index)
 {
-    EmitCode("push local %d\n", index);
+    EmitPushSegment(SEG_LOCAL, index);
 }
 
 void EmitPopPointer(int index)
 {
-    EmitCode("pop pointer %d\n", index);
+    EmitPopSegment(SEG_POINTER, index);
 }
 
 void EmitPopTemp(int index)
 {
-    EmitCode("pop temp %d\n", index);
+    EmitPopSegment(SEG_TEMP, index);
 }
 
 void EmitPopLocal(int index)
 {
-    EmitCode("pop local %d\n", index);
+    EmitPopSegment(SEG_LOCAL, index);
 }
 
-void EmitPop(Symbol* symbol)
+void EmitPop(SymbolId symbol)
 {
-    Symbol* parentSymbol = symbol->parentScope->scopeSymbol;
-    Symbol* scopeSymbol = GetCurrentScope()->scopeSymbol;
-    int address = symbol->address;
+    SymbolId parentSymbol = frozenTable.parents[symbol];
+    SymbolKind kind = frozenTable.kinds[symbol];
+    int address = frozenTable.addresses[symbol];
 
-    if(strcmp(symbol->name, "this") == 0)
+    if(strcmp(frozenTable.names[symbol], "this") == 0)
     {
-        EmitCode("pop pointer 0\n");
+        EmitPopPointer(0);
         return;
     }
 
-    if(strcmp(symbol->kind, "static") == 0)
+    if(kind == KIND_STATIC)
     {
-        EmitCode("pop static %d\n", address);
+        EmitPopSegment(SEG_STATIC, address);
         return;
     }
 
-    if(strcmp(symbol->kind, "argument") == 0)
+    if(kind == KIND_ARGUMENT)
     {
-        EmitCode("pop argument %d\n", address);
+        EmitPopSegment(SEG_ARGUMENT, address);
         return;
     }
 
-    if(strcmp(parentSymbol->kind, "class") == 0)
+    if(frozenTable.kinds[parentSymbol] == KIND_CLASS)
     {
-        EmitCode("pop this %d\n", address);
+        EmitPopSegment(SEG_THIS, address);
         return;
     }
 
     EmitPopLocal(address);
 }
 
-void EmitPush(Symbol* symbol)
+void EmitPush(SymbolId symbol)
 {
-    Symbol* parentSymbol = symbol->parentScope->scopeSymbol;
-    Symbol* scopeSymbol = GetCurrentScope()->scopeSymbol;
-    int address = symbol->address;
+    SymbolId parentSymbol = frozenTable.parents[symbol];
+    SymbolKind kind = frozenTable.kinds[symbol];
+    int address = frozenTable.addresses[symbol];
 
-    if(strcmp(symbol->name, "this") == 0)
+    if(strcmp(frozenTable.names[symbol], "this") == 0)
     {
-        EmitCode("push pointer 0\n");
+        EmitPushSegment(SEG_POINTER, 0);
         return;
     }
 
-    if(strcmp(symbol->kind, "static") == 0)
+    if(kind == KIND_STATIC)
     {
-        EmitCode("push static %d\n", address);
+        EmitPushStatic(address);
         return;
     }
 
-    if(strcmp(symbol->kind, "argument") == 0)
+    if(kind == KIND_ARGUMENT)
     {
-        EmitCode("push argument %d\n", address);
+        EmitPushSegment(SEG_ARGUMENT, address);
         return;
     }
 
-    if(strcmp(parentSymbol->kind, "class") == 0)
+    if(frozenTable.kinds[parentSymbol] == KIND_CLASS)
     {
-        EmitCode("push this %d\n", address);
+        EmitPushSegment(SEG_THIS, address);
         return;
     }
 
     EmitPushLocal(address);
 }
 
-void EmitConstructor(Symbol* symbol)
+void EmitConstructor(SymbolId symbol)
 {
-    int globalVarCount = GetGlobalVarCount(symbol->parentScope);
+    int globalVarCount = frozenTable.frameSizes[frozenTable.parents[symbol]];
 
     EmitFunction1(symbol);
     EmitPushConstant(globalVarCount);
@@ -151,18 +311,20 @@ void EmitConstructor(Symbol* symbol)
     EmitPopPointer(0);
 }
 
-void EmitMethod(Symbol* symbol)
+void EmitMethod(SymbolId symbol)
 {
     EmitFunction1(symbol);
-    EmitCode("push argument 0\n");
+    EmitPushSegment(SEG_ARGUMENT, 0);
     EmitPopPointer(0);
 }
 
-void EmitFunction1(Symbol* symbol)
+void EmitFunction1(SymbolId symbol)
 {
-    char* className = symbol->parentScope->scopeSymbol->name;
-    char* functionName = symbol->name;
-    int argumentCount = GetLocalVarCount(symbol);
+    char* className = frozenTable.names[frozenTable.parents[symbol]];
+    char* functionName = frozenTable.names[symbol];
+    int argumentCount = frozenTable.frameSizes[symbol];
+
+    currentFunction = symbol;
 
     EmitFunction2(className, functionName, argumentCount);
 }
@@ -172,69 +334,69 @@ void EmitFunction2(char* className, char* functionName, int argumentCount)
     whileCount = 0;
     ifCount = 0;
 
-    EmitCode("function %s.%s %d\n", className, functionName, argumentCount);
+    AddInstruction(OP_FUNCTION, SEG_NONE, argumentCount, GetFunctionNameId(className, functionName));
 }
 
-void EmitCaller(Symbol* caller)
+void EmitCaller(SymbolId caller)
 {
-    if(caller == NULL)
+    if(caller == NO_SYMBOL)
     {
-        Symbol* scopeSymbol = GetCurrentScope()->scopeSymbol;
+        SymbolKind functionKind = frozenTable.kinds[currentFunction];
 
-        if(strcmp(scopeSymbol->kind, "method") == 0)
-            EmitCode("push pointer 0\n");
-        else if (strcmp(scopeSymbol->kind, "constructor") == 0)
-            EmitCode("push pointer 0\n");
+        if(functionKind == KIND_METHOD)
+            EmitPushSegment(SEG_POINTER, 0);
+        else if (functionKind == KIND_CONSTRUCTOR)
+            EmitPushSegment(SEG_POINTER, 0);
     }
 
-    if(caller != NULL)
+    if(caller != NO_SYMBOL)
     {
-        if(strcmp(caller->kind, "class") != 0)
+        if(frozenTable.kinds[caller] != KIND_CLASS)
             EmitPush(caller);
     }
 }
 
-void EmitCall1(Symbol* symbol)
+void EmitCall1(SymbolId symbol)
 {
-    char* className = symbol->parentScope->scopeSymbol->name;
-    char* functionName = symbol->name;
-    int argumentCount = GetArgumentCount(symbol);
-    
+    char* className = frozenTable.names[frozenTable.parents[symbol]];
+    char* functionName = frozenTable.names[symbol];
+    int argumentCount = frozenTable.argumentCounts[symbol];
+
     EmitCall2(className, functionName, argumentCount);
 }
 
 void EmitCall2(char* className, char* functionName, int argumentCount)
 {
-    EmitCode("call %s.%s %d\n", className, functionName, argumentCount);
+    AddInstruction(OP_CALL, SEG_NONE, argumentCount, GetFunctionNameId(className, functionName));
 }
 
 int EmitStartWhile1()
 {
     int whileIndex = whileCount;
-    EmitCode("label WHILE_EXP%d\n", whileIndex);
+    EmitLabel(OP_LABEL, LABEL_WHILE_EXP, whileIndex);
     whileCount++;
     return whileIndex;
 }
 
 void EmitStartWhile2(int whileIndex)
 {
-    EmitCode("not\n");
-    EmitCode("if-goto WHILE_END%d\n", whileIndex);
+    EmitOperation(OP_NOT);
+    EmitLabel(OP_IF_GOTO, LABEL_WHILE_END, whileIndex);
 }
 
 void EmitEndWhile(int whileIndex)
 {
-    EmitCode("goto WHILE_EXP%d\n", whileIndex);
-    EmitCode("label WHILE_END%d\n", whileIndex);
+    EmitLabel(OP_GOTO, LABEL_WHILE_EXP, whileIndex);
+    EmitLabel(OP_LABEL, LABEL_WHILE_END, whileIndex);
 }
 
 int EmitIfStart()
 {
     int ifIndex = ifCount;
 
-    EmitCode("if-goto IF_TRUE%d\n", ifIndex);
-    EmitCode("goto IF_FALSE%d\n", ifIndex);
-    EmitCode("label IF_TRUE%d\n", ifIndex);
+    EmitLabel(OP_IF_GOTO, LABEL_IF_TRUE, ifIndex);
+    EmitLabel(OP_GOTO, LABEL_IF_FALSE, ifIndex);
+    EmitLabel(OP_LABEL, LABEL_IF_TRUE, ifIndex);
     ifCount++;
 
     return ifIndex;
@@ -242,21 +404,58 @@ int EmitIfStart()
 
 void EmitIfEnd(int ifIndex)
 {
-    EmitCode("label IF_FALSE%d\n", ifIndex);
+    EmitLabel(OP_LABEL, LABEL_IF_FALSE, ifIndex);
 }
 
 void EmitElseStart(int ifIndex)
 {
-    EmitCode("goto IF_END%d\n", ifIndex);
-    EmitCode("label IF_FALSE%d\n", ifIndex);
+    EmitLabel(OP_GOTO, LABEL_IF_END, ifIndex);
+    EmitLabel(OP_LABEL, LABEL_IF_FALSE, ifIndex);
 }
 
 void EmitElseEnd(int ifIndex)
 {
-    EmitCode("label IF_END%d\n", ifIndex);
+    EmitLabel(OP_LABEL, LABEL_IF_END, ifIndex);
+}
+
+/// @brief Returns the pool index of the literal in the current file, adding it the first time.
+int GetPooledString(char* string)
+{
+    for (int i = 0; i < pooledStringCount; i++)
+    {
+        if (strcmp(pooledStrings[i], string) == 0)
+            return i;
+    }
+
+    pooledStrings = (char**)realloc(pooledStrings, sizeof(char*) * (pooledStringCount + 1));
+    pooledStrings[pooledStringCount] = (char*)malloc(strlen(string) + 1);
+    strcpy(pooledStrings[pooledStringCount], string);
+
+    return pooledStringCount++;
 }
 
 void EmitString(char* string)
+{
+    if (!IsOptimizationEnabled(OPT_STRINGS))
+    {
+        EmitNewString(string);
+        return;
+    }
+
+    // The literal is built the first time this static is still 0 and reused after that
+    SymbolId classSymbol = frozenTable.parents[currentFunction];
+    int slot = frozenTable.staticCounts[classSymbol] + GetPooledString(string);
+    int label = stringLabelCount++;
+
+    EmitPushStatic(slot);
+    EmitLabel(OP_IF_GOTO, LABEL_STRING_READY, label);
+    EmitNewString(string);
+    EmitPopSegment(SEG_STATIC, slot);
+    EmitLabel(OP_LABEL, LABEL_STRING_READY, label);
+    EmitPushStatic(slot);
+}
+
+void EmitNewString(char* string)
 {
     int length = strlen(string);
 
@@ -267,23 +466,23 @@ void EmitString(char* string)
     {
         EmitPushConstant(string[i]);
         EmitCall2("String", "appendChar", 2);
-    }   
+    }
 }
 
 void EmitLetArray(int arrayAdress)
 {
-    EmitCode("pop temp 0\n");
-    EmitCode("pop pointer 1\n");
-    EmitCode("push temp 0\n");
-    EmitCode("pop that %d\n", arrayAdress);
+    EmitPopTemp(0);
+    EmitPopPointer(1);
+    EmitPushSegment(SEG_TEMP, 0);
+    EmitPopSegment(SEG_THAT, arrayAdress);
 }
 
 void EmitAccessArray(int arrayAdress)
 {
     EmitPushLocal(arrayAdress);
-    EmitCode("add\n");
-    EmitCode("pop pointer 1\n");
-    EmitCode("push that %d\n", arrayAdress);
+    EmitOperation(OP_ADD);
+    EmitPopPointer(1);
+    EmitPushSegment(SEG_THAT, arrayAdress);
 }
 
 void EmitDivide()
@@ -298,10 +497,233 @@ void EmitMultiply()
 
 void EmitReturn()
 {
-    EmitCode("return\n");
+    EmitOperation(OP_RETURN);
+}
+
+/// @brief Makes room for at least size more bytes in the code buffer.
+void ReserveCode(size_t size)
+{
+    if (codeLength + size <= codeCapacity)
+        return;
+
+    while (codeLength + size > codeCapacity)
+        codeCapacity *= 2;
+
+    codeBuffer = (char*)realloc(codeBuffer, codeCapacity);
+
+    if (codeBuffer == NULL)
+    {
+        printf("Error: out of memory for generated code\n");
+        exit(1);
+    }
+}
+
+/// @brief Appends text to the code buffer as is.
+void AppendText(const char* text)
+{
+    size_t length = strlen(text);
+
+    ReserveCode(length);
+    memcpy(codeBuffer + codeLength, text, length);
+    codeLength += length;
+}
+
+/// @brief Appends a decimal number to the code buffer without going through printf.
+void AppendNumber(int value)
+{
+    char digits[12];
+    int count = 0;
+    unsigned int magnitude = value < 0 ? -(unsigned int)value : (unsigned int)value;
+
+    do
+    {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    ReserveCode(count + 1);
+
+    if (value < 0)
+        codeBuffer[codeLength++] = '-';
+
+    while (count > 0)
+        codeBuffer[codeLength++] = digits[--count];
+}
+
+/// @brief Appends the VM text of one instruction.
+void PrintInstruction(Instruction* instruction)
+{
+    AppendText(opcodeNames[instruction->opcode]);
+
+    switch (instruction->opcode)
+    {
+    case OP_PUSH:
+    case OP_POP:
+        AppendText(" ");
+        AppendText(segmentNames[instruction->segment]);
+        AppendText(" ");
+        AppendNumber(instruction->index);
+        break;
+    case OP_LABEL:
+    case OP_GOTO:
+    case OP_IF_GOTO:
+        AppendText(" ");
+        AppendText(labelNames[instruction->target]);
+        AppendNumber(instruction->index);
+        break;
+    case OP_FUNCTION:
+    case OP_CALL:
+    {
+        FunctionName* name = GetFunctionName(instruction->target);
+        AppendText(" ");
+        AppendText(name->className);
+        AppendText(".");
+        AppendText(name->functionName);
+        AppendText(" ");
+        AppendNumber(instruction->index);
+        break;
+    }
+    default:
+        break;
+    }
+
+    AppendText("\n");
+}
+
+/// @brief Prints instructions into the code buffer.
+void PrintCode(Instruction* code, int count)
+{
+    if (codeBuffer == NULL)
+    {
+        codeCapacity = CODE_BUFFER_SIZE;
+        codeBuffer = (char*)malloc(codeCapacity);
+    }
+
+    codeLength = 0;
+
+    for (int i = 0; i < count; i++)
+        PrintInstruction(&code[i]);
+}
+
+/// @brief Writes the code buffer to a file and closes it.
+void WriteCode(int file)
+{
+    // Write the whole file at once, write may take less than asked for
+    size_t written = 0;
+
+    while (written < codeLength)
+    {
+        ssize_t result = write(file, codeBuffer + written, codeLength - written);
+
+        if (result < 0)
+        {
+            printf("Error writing to file: ");
+            perror("");
+            break;
+        }
+
+        written += result;
+    }
+
+    close(file);
+    codeLength = 0;
+}
+
+/// @brief Keeps the instructions and the file of the current file for FinishCodeGeneration.
+void HoldCode()
+{
+    heldFiles = (GeneratedFile*)realloc(heldFiles, sizeof(GeneratedFile) * (heldFileCount + 1));
+
+    if (heldFiles == NULL)
+    {
+        printf("Error: out of memory for generated code\n");
+        exit(1);
+    }
+
+    heldFiles[heldFileCount].file = codeFile;
+    heldFiles[heldFileCount].code = instructions;
+    heldFiles[heldFileCount].count = instructionCount;
+    heldFileCount++;
+
+    // The next file starts a new array
+    instructions = NULL;
+    instructionCapacity = 0;
 }
 
 void StopCodeGeneration()
 {
-    fclose(codeFile);
+    OptimizeCode(&instructions, &instructionCount, &instructionCapacity);
+
+    // Whether a function is called, and what it does, is only known once every file is generated
+    if (IsOptimizationEnabled(OPT_DEAD_FUNCTIONS) || IsOptimizationEnabled(OPT_INLINE))
+    {
+        HoldCode();
+    }
+    else
+    {
+        PrintCode(instructions, instructionCount);
+        WriteCode(codeFile);
+    }
+
+    codeFile = -1;
+    instructionCount = 0;
+
+    for (int i = 0; i < pooledStringCount; i++)
+        free(pooledStrings[i]);
+
+    free(pooledStrings);
+    pooledStrings = NULL;
+    pooledStringCount = 0;
+}
+
+/// @brief Writes the files held back by StopCodeGeneration, after the whole program optimizations.
+void FinishCodeGeneration()
+{
+    if (heldFileCount == 0)
+        return;
+
+    // Inlined functions may have no calls left
+    if (IsOptimizationEnabled(OPT_INLINE))
+        InlineFunctions(heldFiles, heldFileCount);
+
+    if (IsOptimizationEnabled(OPT_DEAD_FUNCTIONS))
+        EliminateDeadFunctions(heldFiles, heldFileCount);
+
+    for (int i = 0; i < heldFileCount; i++)
+    {
+        PrintCode(heldFiles[i].code, heldFiles[i].count);
+        WriteCode(heldFiles[i].file);
+        free(heldFiles[i].code);
+    }
+
+    free(heldFiles);
+    heldFiles = NULL;
+    heldFileCount = 0;
+}
+
+void FreeCodeGeneration()
+{
+    // Files still held when compilation stopped on an error
+    for (int i = 0; i < heldFileCount; i++)
+    {
+        close(heldFiles[i].file);
+        free(heldFiles[i].code);
+    }
+
+    free(heldFiles);
+    heldFiles = NULL;
+    heldFileCount = 0;
+    free(instructions);
+    free(codeBuffer);
+    free(functionNames);
+    free(functionNameTable);
+    instructions = NULL;
+    instructionCount = 0;
+    instructionCapacity = 0;
+    codeBuffer = NULL;
+    codeCapacity = 0;
+    functionNames = NULL;
+    functionNameCount = 0;
+    functionNameTable = NULL;
+    functionNameTableSize = 0;
 }
@@ -1,20 +1,110 @@
+#ifndef CODEGENERATION_H
+#define CODEGENERATION_H
+
 #include "symbols.h"
 
+typedef enum
+{
+    OP_PUSH,
+    OP_POP,
+    OP_ADD,
+    OP_SUB,
+    OP_NEG,
+    OP_EQ,
+    OP_GT,
+    OP_LT,
+    OP_AND,
+    OP_OR,
+    OP_NOT,
+    OP_LABEL,
+    OP_GOTO,
+    OP_IF_GOTO,
+    OP_FUNCTION,
+    OP_CALL,
+    OP_RETURN,
+    OP_COUNT
+} Opcode;
+
+typedef enum
+{
+    SEG_NONE,
+    SEG_CONSTANT,
+    SEG_ARGUMENT,
+    SEG_LOCAL,
+    SEG_STATIC,
+    SEG_THIS,
+    SEG_THAT,
+    SEG_POINTER,
+    SEG_TEMP,
+    SEG_COUNT
+} Segment;
+
+// Labels are printed as the kind name followed by the label number, WHILE_EXP0
+typedef enum
+{
+    LABEL_WHILE_EXP,
+    LABEL_WHILE_END,
+    LABEL_IF_TRUE,
+    LABEL_IF_FALSE,
+    LABEL_IF_END,
+    LABEL_STRING_READY,
+    LABEL_WHILE_BODY,
+    LABEL_AND_TRUE,
+    LABEL_AND_END,
+    LABEL_OR_TRUE,
+    LABEL_OR_END,
+    LABEL_INTRINSIC_TRUE,
+    LABEL_INTRINSIC_END,
+    LABEL_TAIL_CALL,
+    LABEL_COUNT
+} LabelKind;
+
+// One VM instruction
+typedef struct
+{
+    unsigned char opcode;   // Opcode
+    unsigned char segment;  // Segment of push and pop
+    int index;              // segment index, label number, local count of function, argument count of call
+    int target;             // LabelKind of label, goto and if-goto, function name id of function and call
+} Instruction;
+
+typedef struct
+{
+    char* className;
+    char* functionName;
+    unsigned int hash;
+} FunctionName;
+
+// Code of a file held back until the whole program is generated
+typedef struct
+{
+    int file;               // open output file
+    Instruction* code;
+    int count;
+} GeneratedFile;
+
 int InitCodeGeneration(char* filename);
-void EmitCode(const char *format, ...);
+Instruction* GetInstructions(int* count);
+int GetFunctionNameId(char* className, char* functionName);
+FunctionName* GetFunctionName(int nameId);
+int GetFunctionNameCount();
+void EmitOperation(Opcode opcode);
+void EmitPushSegment(Segment segment, int index);
+void EmitPopSegment(Segment segment, int index);
+void EmitLabel(Opcode opcode, LabelKind label, int number);
 void EmitPushConstant(int value);
 void EmitPushLocal(int index);
 void EmitPopPointer(int index);
 void EmitPopTemp(int index);
 void EmitPopLocal(int index);
-void EmitPop(Symbol* symbol);
-void EmitPush(Symbol* symbol);
-void EmitConstructor(Symbol* symbol);
-void EmitMethod(Symbol* symbol);
-void EmitFunction1(Symbol* symbol);
+void EmitPop(SymbolId symbol);
+void EmitPush(SymbolId symbol);
+void EmitConstructor(SymbolId symbol);
+void EmitMethod(SymbolId symbol);
+void EmitFunction1(SymbolId symbol);
 void EmitFunction2(char* className, char* functionName, int argumentCount);
-void EmitCaller(Symbol* caller);
-void EmitCall1(Symbol* symbol);
+void EmitCaller(SymbolId caller);
+void EmitCall1(SymbolId symbol);
 void EmitCall2(char* className, char* functionName, int argumentCount);
 int EmitStartWhile1();
 void EmitStartWhile2(int whileIndex);
@@ -29,4 +119,8 @@ void EmitAccessArray(int arrayAdress);
 void EmitDivide();
 void EmitMultiply();
 void EmitReturn();
-void StopCodeGeneration();
\ No newline at end of file
+void StopCodeGeneration();
+void FinishCodeGeneration();
+void FreeCodeGeneration();
+
+#endif
@@ -25,6 +25,7 @@ Date Work Commenced:
 #include "symbols.h"
 #include "compiler.h"
 #include "codegeneration.h"
+#include "optimizer.h"
 
 bool secondPass = false;
 
@@ -160,10 +161,11 @@ ParserInfo ParseFiles(char* dir_name)
 
 	if (undeclared != NULL)
 	{
-		Token token = undeclared->pi.tk;
+		ParserInfo undeclaredInfo = GetSymbolParserInfo(undeclared, undecIdentifier);
+		Token token = undeclaredInfo.tk;
 		char* errorMessage = "Undeclared symbol";
 		printf("Error: %s. Accured at line %d near %s token in file %s.\n", errorMessage, token.ln, token.lx, token.fl);
-		return undeclared->pi;
+		return undeclaredInfo;
 	}
 
 	return p;
@@ -180,12 +182,15 @@ ParserInfo compile (char* dir_name)
 	directoryFiles = getJackFiles(dir_name, &directoryFileCount);
 
 	secondPass = false;
+	ResetOptimizationReport();
 
 	p = ParseFiles(dir_name);
 
 	if (p.er != none)
 		return p;
 
+	// The second pass only reads the flattened table
+	FreezeSymbolTable();
 	secondPass = true;
 
 	p = ParseFiles(dir_name);
@@ -193,6 +198,9 @@ ParserInfo compile (char* dir_name)
 	if (p.er != none)
 		return p;
 
+	FinishCodeGeneration();
+	PrintOptimizationReport();
+
 	return p;
 }
 
@@ -201,14 +209,26 @@ int StopCompiler ()
 	//PrintSymbolTable();
 	printf("Compiler stopped.\n");
 	FreeSymbolTable();
+	FreeCodeGeneration();
 	return 1;
 }
 
 #ifndef TEST_COMPILER
-int main ()
+int main (int argc, char** argv)
 {
+	char* dirName = "Square";
+
+	// Options start with -, anything else is the directory to compile
+	for (int i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-')
+			dirName = argv[i];
+		else if (ParseOptimizationFlag(argv[i]) == 0)
+			printf("Unknown option %s\n", argv[i]);
+	}
+
 	InitCompiler ();
-	ParserInfo p = compile ("Square");
+	ParserInfo p = compile (dirName);
 
 	if (p.er != none)
 		printf("Compilation failed\n");
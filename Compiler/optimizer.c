@@ -0,0 +1,2448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "optimizer.h"
+
+#define MAX_WINDOW 5
+#define ANY_OPCODE OP_COUNT
+#define ANY_SEGMENT SEG_COUNT
+#define ANY_INDEX INT_MIN
+#define KEEP_OPCODE -1
+
+// VM steps of one Math.multiply call, measured with the shift and add implementation of the OS
+#define MULTIPLY_CALL_COST 445
+// Longest sequence a multiplication is replaced with, so the code does not grow much
+#define MAX_REDUCED_LENGTH 24
+// Longest body of a function that is inlined unless -Oinline=<n> sets another
+#define INLINE_SIZE_LIMIT 8
+// Temps an array address can be kept in, temp 0 is used by array stores and temps 1 and 2 by strength reduction
+#define FIRST_CSE_TEMP 3
+#define LAST_CSE_TEMP 7
+// Addresses tracked at once in a basic block
+#define MAX_AVAILABLE_ADDRESSES 16
+// Most instructions an unrolled loop body may add
+#define UNROLL_BUDGET 64
+// Shortest right operand of and or or worth skipping with branches
+#define MIN_SHORT_CIRCUIT_LENGTH 4
+
+typedef struct
+{
+    unsigned char opcode;   // ANY_OPCODE matches every opcode
+    unsigned char segment;  // ANY_SEGMENT matches every segment
+    int index;              // ANY_INDEX matches every index
+} PatternInstruction;
+
+// Copies an instruction of the matched window, optionally with another opcode
+typedef struct
+{
+    int source;
+    int opcode;             // KEEP_OPCODE keeps the opcode of the source
+} ReplacementInstruction;
+
+// Extra condition on a matched window that the pattern alone cannot express
+typedef int (*RuleCheck)(Instruction* window);
+
+typedef struct
+{
+    char* name;
+    int length;
+    PatternInstruction pattern[MAX_WINDOW];
+    int replacementLength;
+    ReplacementInstruction replacement[MAX_WINDOW];
+    RuleCheck check;
+} PeepholeRule;
+
+typedef struct
+{
+    char* name;
+    OptimizationFlags flag;
+} OptimizationName;
+
+// Instructions of one function while passes that can make it longer rewrite it
+typedef struct
+{
+    Instruction* code;
+    int length;
+    int capacity;
+} CodeBuffer;
+
+// Address expression of a basic block whose value is still in pointer 1 or a temp
+typedef struct
+{
+    int start;              // expression in the code before the pass
+    int length;
+    int valid;              // 0 once a value the expression reads is changed
+    int temp;               // -1 if not kept in a temp
+} AvailableAddress;
+
+// Start and end of a function definition in the held files
+typedef struct
+{
+    int file;               // -1 if the function is not defined in the program
+    int start;
+    int end;
+} FunctionSpan;
+
+// Code dead function elimination removed from one class
+typedef struct
+{
+    char* className;
+    int functions;
+    int instructions;
+} RemovedCode;
+
+int optimizationFlags = 0;
+int inlineSizeLimit = INLINE_SIZE_LIMIT;
+
+// Totals of the current program, printed by PrintOptimizationReport
+int instructionsBefore = 0;
+int instructionsAfter = 0;
+int peepholeRemoved = 0;
+int foldedOperations = 0;
+int reducedOperations = 0;
+int branchesLaidOut = 0;
+int reusedAddresses = 0;
+int removedLocals = 0;
+int hoistedExpressions = 0;
+int unrolledLoops = 0;
+int shortCircuited = 0;
+int expandedIntrinsics = 0;
+int eliminatedTailCalls = 0;
+int inlinedCalls = 0;
+int removedFunctions = 0;
+RemovedCode* removedCode = NULL;
+int removedClassCount = 0;
+
+static OptimizationName optimizationNames[] = {
+    {"peephole", OPT_PEEPHOLE},
+    {"fold", OPT_FOLD},
+    {"strength", OPT_STRENGTH},
+    {"strings", OPT_STRINGS},
+    {"dead-functions", OPT_DEAD_FUNCTIONS},
+    {"inline", OPT_INLINE},
+    {"branches", OPT_BRANCHES},
+    {"cse", OPT_CSE},
+    {"locals", OPT_LOCALS},
+    {"licm", OPT_LICM},
+    {"unroll", OPT_UNROLL},
+    {"short-circuit", OPT_SHORT_CIRCUIT},
+    {"intrinsics", OPT_INTRINSICS},
+    {"tail-calls", OPT_TAIL_CALLS},
+};
+
+int SameLabel(Instruction* window);
+int NotLabel(Instruction* window);
+int NotLabelOrFunction(Instruction* window);
+int SameLocation(Instruction* window);
+int IndependentOfThat(Instruction* window);
+int MatchPattern(PeepholeRule* rule, Instruction* code, int length);
+int Peephole(Instruction* code, int length);
+int Wrap16(int value);
+int IsOsCall(Instruction* instruction, char* className, char* functionName, int argumentCount);
+int IsMathCall(Instruction* instruction, char* functionName);
+int ReadConstant(Instruction* code, int end, int* value);
+int WriteConstant(Instruction* code, int value);
+int FoldTail(Instruction* code, int length);
+int FoldConstants(Instruction* code, int length);
+void ReserveInstructions(CodeBuffer* buffer, int count);
+void AppendInstruction(CodeBuffer* buffer, Opcode opcode, Segment segment, int index);
+int FindOperandStart(Instruction* code, int end);
+int BitLength(int value);
+int CountBits(int value);
+int MultiplyLength(int factor, int subtract, int simple);
+void AppendMultiply(CodeBuffer* buffer, int factor, Instruction* reload);
+int ReduceTail(CodeBuffer* buffer);
+void ReduceStrength(CodeBuffer* function);
+int IsPureAddress(Instruction* code, int start, int end);
+int SameCode(Instruction* first, Instruction* second, int length);
+int ReadsLocation(Instruction* code, int length, Instruction* pop);
+int CountTempReuses(Instruction* code, int length, int* addressEnds, int start, int end);
+int FindFreeTemp(AvailableAddress* available, int count);
+void ReuseAddresses(CodeBuffer* function);
+int CountJumps(Instruction* code, int length, LabelKind label, int number);
+int IsLabel(Instruction* instruction, Opcode opcode, int label, int number);
+int IsBoolean(Instruction* code, int end);
+int RotateLoop(Instruction* code, int length, int start);
+int LayOutBranches(Instruction* code, int length);
+int FindExpressionStart(Instruction* code, int end);
+int IsPureOperand(Instruction* code, int start, int end);
+void ShortCircuit(CodeBuffer* function);
+int FindCounterStart(Instruction* code, int start, int counter, int* value);
+void AppendConstant(CodeBuffer* buffer, int value);
+int UnrollLoop(CodeBuffer* function, int start);
+void UnrollLoops(CodeBuffer* function);
+int UsesLocalsPastFrame(Instruction* code, int length);
+int IsInvariant(Instruction* code, int start, int end, Instruction* instruction, int hasCall, int writesObject);
+int HoistLoopInvariants(CodeBuffer* function, int start);
+void HoistInvariants(CodeBuffer* function);
+int FindBlock(Instruction* code, int* blockStarts, int blockCount, Instruction* jump);
+void AddInterference(char* interferes, int localCount, char* live, int local);
+void PackLocals(Instruction* code, int length);
+void AppendLabel(CodeBuffer* buffer, Opcode opcode, LabelKind label, int number);
+void ExpandIntrinsics(CodeBuffer* function);
+int TailCallLength(Instruction* code, int length, int i, int voidResults);
+void EliminateTailCalls(CodeBuffer* function);
+void OptimizeFunction(CodeBuffer* function);
+FunctionSpan* FindFunctionSpans(GeneratedFile* files, int fileCount, int nameCount);
+int IsInlineCandidate(Instruction* function, int length);
+int AppendInlinedBody(CodeBuffer* buffer, Instruction* function, int length, int argumentCount, int base);
+void MarkCalledFunctions(GeneratedFile* files, FunctionSpan* spans, int nameId, char* reachable, int* worklist, int* worklistLength);
+void RecordRemovedFunction(char* className, int instructions);
+
+static PeepholeRule peepholeRules[] = {
+    // not not x is x
+    {"double not", 2, {{OP_NOT, ANY_SEGMENT, ANY_INDEX}, {OP_NOT, ANY_SEGMENT, ANY_INDEX}}, 0, {{0}}, NULL},
+    {"double neg", 2, {{OP_NEG, ANY_SEGMENT, ANY_INDEX}, {OP_NEG, ANY_SEGMENT, ANY_INDEX}}, 0, {{0}}, NULL},
+    {"add zero", 2, {{OP_PUSH, SEG_CONSTANT, 0}, {OP_ADD, ANY_SEGMENT, ANY_INDEX}}, 0, {{0}}, NULL},
+    {"sub zero", 2, {{OP_PUSH, SEG_CONSTANT, 0}, {OP_SUB, ANY_SEGMENT, ANY_INDEX}}, 0, {{0}}, NULL},
+    // A branch on true always jumps, a branch on false never does
+    {"branch on true", 3, {{OP_PUSH, SEG_CONSTANT, 0}, {OP_NOT, ANY_SEGMENT, ANY_INDEX}, {OP_IF_GOTO, ANY_SEGMENT, ANY_INDEX}}, 1, {{2, OP_GOTO}}, NULL},
+    {"branch on false", 2, {{OP_PUSH, SEG_CONSTANT, 0}, {OP_IF_GOTO, ANY_SEGMENT, ANY_INDEX}}, 0, {{0}}, NULL},
+    {"jump to next", 2, {{OP_GOTO, ANY_SEGMENT, ANY_INDEX}, {OP_LABEL, ANY_SEGMENT, ANY_INDEX}}, 1, {{1, KEEP_OPCODE}}, SameLabel},
+    // Nothing after a goto or return runs until the next label
+    {"unreachable after goto", 2, {{OP_GOTO, ANY_SEGMENT, ANY_INDEX}, {ANY_OPCODE, ANY_SEGMENT, ANY_INDEX}}, 1, {{0, KEEP_OPCODE}}, NotLabel},
+    {"unreachable after return", 2, {{OP_RETURN, ANY_SEGMENT, ANY_INDEX}, {ANY_OPCODE, ANY_SEGMENT, ANY_INDEX}}, 1, {{0, KEEP_OPCODE}}, NotLabelOrFunction},
+    {"store of load", 2, {{OP_PUSH, ANY_SEGMENT, ANY_INDEX}, {OP_POP, ANY_SEGMENT, ANY_INDEX}}, 0, {{0}}, SameLocation},
+    // A value that does not read that can be pushed after the array address is set, without the temp 0 shuffle
+    {"array store", 5, {{OP_PUSH, ANY_SEGMENT, ANY_INDEX}, {OP_POP, SEG_TEMP, 0}, {OP_POP, SEG_POINTER, 1}, {OP_PUSH, SEG_TEMP, 0}, {OP_POP, SEG_THAT, ANY_INDEX}},
+        3, {{2, KEEP_OPCODE}, {0, KEEP_OPCODE}, {4, KEEP_OPCODE}}, IndependentOfThat},
+};
+
+#define PEEPHOLE_RULE_COUNT (int)(sizeof(peepholeRules) / sizeof(peepholeRules[0]))
+#define OPTIMIZATION_NAME_COUNT (int)(sizeof(optimizationNames) / sizeof(optimizationNames[0]))
+
+/// @brief Enables the optimizations named by a command line argument, -O for all or -O<name> for one. Returns 0 if the argument is not an optimization flag.
+int ParseOptimizationFlag(char* argument)
+{
+    if (strncmp(argument, "-O", 2) != 0)
+        return 0;
+
+    if (argument[2] == '\0')
+    {
+        optimizationFlags |= OPT_ALL;
+        return 1;
+    }
+
+    // -Oinline=<n> also sets the longest body that is inlined
+    if (strncmp(argument + 2, "inline=", 7) == 0)
+    {
+        inlineSizeLimit = atoi(argument + 9);
+        optimizationFlags |= OPT_INLINE;
+        return 1;
+    }
+
+    for (int i = 0; i < OPTIMIZATION_NAME_COUNT; i++)
+    {
+        if (strcmp(argument + 2, optimizationNames[i].name) == 0)
+        {
+            optimizationFlags |= optimizationNames[i].flag;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void SetOptimizations(int flags)
+{
+    optimizationFlags = flags;
+}
+
+int IsOptimizationEnabled(OptimizationFlags flag)
+{
+    return (optimizationFlags & flag) != 0;
+}
+
+int SameLabel(Instruction* window)
+{
+    return window[0].target == window[1].target && window[0].index == window[1].index;
+}
+
+int NotLabel(Instruction* window)
+{
+    return window[1].opcode != OP_LABEL;
+}
+
+int NotLabelOrFunction(Instruction* window)
+{
+    return window[1].opcode != OP_LABEL && window[1].opcode != OP_FUNCTION;
+}
+
+int SameLocation(Instruction* window)
+{
+    return window[0].segment == window[1].segment && window[0].index == window[1].index;
+}
+
+int IndependentOfThat(Instruction* window)
+{
+    return window[0].segment != SEG_THAT && window[0].segment != SEG_POINTER;
+}
+
+int MatchPattern(PeepholeRule* rule, Instruction* code, int length)
+{
+    if (rule->length > length)
+        return 0;
+
+    for (int i = 0; i < rule->length; i++)
+    {
+        PatternInstruction* pattern = &rule->pattern[i];
+
+        if (pattern->opcode != ANY_OPCODE && pattern->opcode != code[i].opcode)
+            return 0;
+
+        if (pattern->segment != ANY_SEGMENT && pattern->segment != code[i].segment)
+            return 0;
+
+        if (pattern->index != ANY_INDEX && pattern->index != code[i].index)
+            return 0;
+    }
+
+    return rule->check == NULL || rule->check(code);
+}
+
+/// @brief Rewrites the instructions with the rule table until no rule matches, returns the new length.
+int Peephole(Instruction* code, int length)
+{
+    int changed = 1;
+
+    while (changed)
+    {
+        changed = 0;
+        int written = 0;
+        int read = 0;
+
+        while (read < length)
+        {
+            PeepholeRule* rule = NULL;
+
+            for (int i = 0; i < PEEPHOLE_RULE_COUNT && rule == NULL; i++)
+            {
+                if (MatchPattern(&peepholeRules[i], code + read, length - read))
+                    rule = &peepholeRules[i];
+            }
+
+            if (rule == NULL)
+            {
+                code[written++] = code[read++];
+                continue;
+            }
+
+            // The replacement is never longer than the window, so it can be written over the code already read
+            Instruction window[MAX_WINDOW];
+            memcpy(window, code + read, sizeof(Instruction) * rule->length);
+
+            for (int i = 0; i < rule->replacementLength; i++)
+            {
+                code[written] = window[rule->replacement[i].source];
+
+                if (rule->replacement[i].opcode != KEEP_OPCODE)
+                    code[written].opcode = (unsigned char)rule->replacement[i].opcode;
+
+                written++;
+            }
+
+            read += rule->length;
+            peepholeRemoved += rule->length - rule->replacementLength;
+            changed = 1;
+        }
+
+        length = written;
+    }
+
+    return length;
+}
+
+/// @brief Wraps a value to the 16 bit two's complement range of the Hack machine.
+int Wrap16(int value)
+{
+    value &= 0xFFFF;
+
+    return value >= 0x8000 ? value - 0x10000 : value;
+}
+
+int IsOsCall(Instruction* instruction, char* className, char* functionName, int argumentCount)
+{
+    if (instruction->opcode != OP_CALL || instruction->index != argumentCount)
+        return 0;
+
+    FunctionName* name = GetFunctionName(instruction->target);
+
+    return strcmp(name->className, className) == 0 && strcmp(name->functionName, functionName) == 0;
+}
+
+int IsMathCall(Instruction* instruction, char* functionName)
+{
+    return IsOsCall(instruction, "Math", functionName, 2);
+}
+
+/// @brief Reads the constant pushed by the instructions that end before end: push constant k, optionally followed by neg or not. Returns how many instructions it spans, 0 if they do not push a constant.
+int ReadConstant(Instruction* code, int end, int* value)
+{
+    if (end >= 1 && code[end - 1].opcode == OP_PUSH && code[end - 1].segment == SEG_CONSTANT)
+    {
+        *value = code[end - 1].index;
+        return 1;
+    }
+
+    if (end < 2 || code[end - 2].opcode != OP_PUSH || code[end - 2].segment != SEG_CONSTANT)
+        return 0;
+
+    if (code[end - 1].opcode == OP_NEG)
+    {
+        *value = Wrap16(-code[end - 2].index);
+        return 2;
+    }
+
+    if (code[end - 1].opcode == OP_NOT)
+    {
+        *value = Wrap16(~code[end - 2].index);
+        return 2;
+    }
+
+    return 0;
+}
+
+/// @brief Writes the shortest push of a constant, -1 as push constant 0, not like true. Returns the number of instructions written.
+int WriteConstant(Instruction* code, int value)
+{
+    Instruction push = {OP_PUSH, SEG_CONSTANT, value < 0 ? -value : value, 0};
+    Instruction unary = {value == -1 ? OP_NOT : OP_NEG, SEG_NONE, 0, 0};
+
+    if (value == -1)
+        push.index = 0;
+
+    code[0] = push;
+
+    if (value >= 0)
+        return 1;
+
+    code[1] = unary;
+    return 2;
+}
+
+/// @brief Folds the operation at the end of the code if its operands are constants. Returns the new length.
+int FoldTail(Instruction* code, int length)
+{
+    Instruction* operation = &code[length - 1];
+    int a = 0;
+    int b = 0;
+    int result = 0;
+    int lengthA = 0;
+    int lengthB = 0;
+
+    if (operation->opcode == OP_NEG || operation->opcode == OP_NOT)
+    {
+        // A single push with neg or not is already the shortest form
+        lengthA = ReadConstant(code, length - 1, &a);
+
+        if (lengthA != 2)
+            return length;
+
+        result = Wrap16(operation->opcode == OP_NEG ? -a : ~a);
+    }
+    else
+    {
+        int multiply = IsMathCall(operation, "multiply");
+        int divide = IsMathCall(operation, "divide");
+
+        switch (operation->opcode)
+        {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_AND:
+        case OP_OR:
+        case OP_EQ:
+        case OP_GT:
+        case OP_LT:
+            break;
+        default:
+            if (!multiply && !divide)
+                return length;
+        }
+
+        lengthB = ReadConstant(code, length - 1, &b);
+
+        if (lengthB == 0)
+            return length;
+
+        lengthA = ReadConstant(code, length - 1 - lengthB, &a);
+
+        if (lengthA == 0)
+            return length;
+
+        // Division by zero is left for Math.divide to report
+        if (divide && b == 0)
+            return length;
+
+        if (multiply)
+            result = Wrap16(a * b);
+        else if (divide)
+            result = Wrap16(a / b);
+        else if (operation->opcode == OP_ADD)
+            result = Wrap16(a + b);
+        else if (operation->opcode == OP_SUB)
+            result = Wrap16(a - b);
+        else if (operation->opcode == OP_AND)
+            result = a & b;
+        else if (operation->opcode == OP_OR)
+            result = a | b;
+        else if (operation->opcode == OP_EQ)
+            result = a == b ? -1 : 0;
+        else if (operation->opcode == OP_GT)
+            result = a > b ? -1 : 0;
+        else
+            result = a < b ? -1 : 0;
+    }
+
+    // -32768 has no constant to negate
+    if (result == -32768)
+        return length;
+
+    int start = length - 1 - lengthB - lengthA;
+    foldedOperations++;
+
+    return start + WriteConstant(code + start, result);
+}
+
+/// @brief Replaces operations on constant operands by the constant they compute, with 16 bit wraparound.
+int FoldConstants(Instruction* code, int length)
+{
+    int written = 0;
+
+    // Operands always come before their operation, so folding at the end as instructions are copied folds nested expressions too
+    for (int read = 0; read < length; read++)
+    {
+        code[written++] = code[read];
+        written = FoldTail(code, written);
+    }
+
+    return written;
+}
+
+void ReserveInstructions(CodeBuffer* buffer, int count)
+{
+    if (buffer->length + count <= buffer->capacity)
+        return;
+
+    while (buffer->length + count > buffer->capacity)
+        buffer->capacity = buffer->capacity == 0 ? 256 : buffer->capacity * 2;
+
+    buffer->code = (Instruction*)realloc(buffer->code, sizeof(Instruction) * buffer->capacity);
+
+    if (buffer->code == NULL)
+    {
+        printf("Error: out of memory for generated code\n");
+        exit(1);
+    }
+}
+
+void AppendInstruction(CodeBuffer* buffer, Opcode opcode, Segment segment, int index)
+{
+    ReserveInstructions(buffer, 1);
+
+    Instruction* instruction = &buffer->code[buffer->length++];
+    instruction->opcode = (unsigned char)opcode;
+    instruction->segment = (unsigned char)segment;
+    instruction->index = index;
+    instruction->target = 0;
+}
+
+/// @brief Finds where the straight line code that pushes the value on top of the stack at end starts, -1 if a label or jump is in the way.
+int FindOperandStart(Instruction* code, int end)
+{
+    // Number of values still needed, walking back over what each instruction pops and pushes
+    int needed = 1;
+
+    for (int i = end - 1; i >= 0; i--)
+    {
+        switch (code[i].opcode)
+        {
+        case OP_PUSH:
+            needed--;
+            break;
+        case OP_POP:
+            needed++;
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_AND:
+        case OP_OR:
+        case OP_EQ:
+        case OP_GT:
+        case OP_LT:
+            needed++;
+            break;
+        case OP_NEG:
+        case OP_NOT:
+            break;
+        case OP_CALL:
+            needed += code[i].index - 1;
+            break;
+        default:
+            return -1;
+        }
+
+        if (needed == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+int BitLength(int value)
+{
+    int length = 0;
+
+    while (value != 0)
+    {
+        length++;
+        value >>= 1;
+    }
+
+    return length;
+}
+
+int CountBits(int value)
+{
+    int count = 0;
+
+    while (value != 0)
+    {
+        count += value & 1;
+        value >>= 1;
+    }
+
+    return count;
+}
+
+/// @brief Number of instructions (and VM steps) AppendMultiply uses for a positive factor of 2 or more.
+/// The add chain doubles for every bit and adds x for every set bit, the subtract chain computes x * 2^k - x when factor is 2^k - 1.
+int MultiplyLength(int factor, int subtract, int simple)
+{
+    // Saving a value that cannot be pushed again takes pop temp 1, push temp 1
+    int length = simple ? 0 : 2;
+
+    // The first doubling is x + x, the following ones copy the sum through temp 2
+    if (subtract)
+    {
+        int doublings = BitLength(factor + 1) - 1;
+        return length + 2 + 4 * (doublings - 1) + 2;
+    }
+
+    return length + 2 + 4 * (BitLength(factor) - 2) + 2 * (CountBits(factor) - 1);
+}
+
+/// @brief Appends the code that multiplies the value on top of the stack by factor, reload pushes that value again. With reload NULL the value is saved in temp 1.
+void AppendMultiply(CodeBuffer* buffer, int factor, Instruction* reload)
+{
+    int magnitude = factor < 0 ? -factor : factor;
+    int simple = reload != NULL;
+    Instruction saved = {OP_PUSH, SEG_TEMP, 1, 0};
+
+    if (!simple)
+    {
+        AppendInstruction(buffer, OP_POP, SEG_TEMP, 1);
+        AppendInstruction(buffer, OP_PUSH, SEG_TEMP, 1);
+        reload = &saved;
+    }
+
+    int subtract = magnitude > 2 && CountBits(magnitude + 1) == 1 && MultiplyLength(magnitude, 1, simple) < MultiplyLength(magnitude, 0, simple);
+    int doublings = subtract ? BitLength(magnitude + 1) - 1 : BitLength(magnitude) - 1;
+
+    for (int i = doublings - 1; i >= 0; i--)
+    {
+        if (i == doublings - 1)
+        {
+            AppendInstruction(buffer, OP_PUSH, (Segment)reload->segment, reload->index);
+        }
+        else
+        {
+            AppendInstruction(buffer, OP_POP, SEG_TEMP, 2);
+            AppendInstruction(buffer, OP_PUSH, SEG_TEMP, 2);
+            AppendInstruction(buffer, OP_PUSH, SEG_TEMP, 2);
+        }
+
+        AppendInstruction(buffer, OP_ADD, SEG_NONE, 0);
+
+        if (!subtract && (magnitude >> i & 1) != 0)
+        {
+            AppendInstruction(buffer, OP_PUSH, (Segment)reload->segment, reload->index);
+            AppendInstruction(buffer, OP_ADD, SEG_NONE, 0);
+        }
+    }
+
+    if (subtract)
+    {
+        AppendInstruction(buffer, OP_PUSH, (Segment)reload->segment, reload->index);
+        AppendInstruction(buffer, OP_SUB, SEG_NONE, 0);
+    }
+
+    if (factor < 0)
+        AppendInstruction(buffer, OP_NEG, SEG_NONE, 0);
+}
+
+/// @brief Replaces a Math.multiply or Math.divide call at the end of the buffer when one operand is a constant it can do without the call. Returns 1 if it did.
+int ReduceTail(CodeBuffer* buffer)
+{
+    Instruction* code = buffer->code;
+    int call = buffer->length - 1;
+    int multiply = IsMathCall(&code[call], "multiply");
+    int divide = IsMathCall(&code[call], "divide");
+    int factor = 0;
+    int operandStart = -1;
+    int simple = 0;
+
+    if (!multiply && !divide)
+        return 0;
+
+    int constantLength = ReadConstant(code, call, &factor);
+
+    if (constantLength > 0)
+    {
+        // A value pushed by a single push can be pushed again instead of being saved
+        simple = call - constantLength > 0 && code[call - constantLength - 1].opcode == OP_PUSH;
+    }
+    else if (multiply)
+    {
+        // The constant may be the first operand, the product is the same with the operands swapped
+        operandStart = FindOperandStart(code, call);
+
+        if (operandStart < 0)
+            return 0;
+
+        constantLength = ReadConstant(code, operandStart, &factor);
+
+        if (constantLength == 0)
+            return 0;
+
+        simple = call - operandStart == 1 && code[operandStart].opcode == OP_PUSH;
+    }
+    else
+    {
+        return 0;
+    }
+
+    int magnitude = factor < 0 ? -factor : factor;
+
+    // The VM has no shift, so only division by 1 and -1 does without the call
+    if (divide && magnitude != 1)
+        return 0;
+
+    if (magnitude >= 2)
+    {
+        int length = MultiplyLength(magnitude, 0, simple);
+
+        if (magnitude > 2 && CountBits(magnitude + 1) == 1 && MultiplyLength(magnitude, 1, simple) < length)
+            length = MultiplyLength(magnitude, 1, simple);
+
+        if (factor < 0)
+            length++;
+
+        if (length > MAX_REDUCED_LENGTH || length >= MULTIPLY_CALL_COST)
+            return 0;
+    }
+
+    if (operandStart >= 0)
+        memmove(code + operandStart - constantLength, code + operandStart, sizeof(Instruction) * (call - operandStart));
+
+    // Drop the constant and the call, the operand now ends the buffer
+    buffer->length = call - constantLength;
+    Instruction operand = code[buffer->length - 1];
+    reducedOperations++;
+
+    if (factor == 0)
+    {
+        // x * 0 still evaluates x unless it is a plain push
+        if (simple)
+            buffer->length--;
+        else
+            AppendInstruction(buffer, OP_POP, SEG_TEMP, 1);
+
+        AppendInstruction(buffer, OP_PUSH, SEG_CONSTANT, 0);
+    }
+    else if (magnitude == 1)
+    {
+        if (factor < 0)
+            AppendInstruction(buffer, OP_NEG, SEG_NONE, 0);
+    }
+    else
+    {
+        AppendMultiply(buffer, factor, simple ? &operand : NULL);
+    }
+
+    return 1;
+}
+
+/// @brief Replaces multiplications and divisions by constants with add chains where they are cheaper than the OS call.
+void ReduceStrength(CodeBuffer* function)
+{
+    CodeBuffer reduced = {NULL, 0, 0};
+
+    for (int i = 0; i < function->length; i++)
+    {
+        ReserveInstructions(&reduced, 1);
+        reduced.code[reduced.length++] = function->code[i];
+        ReduceTail(&reduced);
+    }
+
+    free(function->code);
+    *function = reduced;
+}
+
+/// @brief Checks if code only combines constants, locals, arguments and statics, so it gives the same value until one of them is written.
+int IsPureAddress(Instruction* code, int start, int end)
+{
+    for (int i = start; i < end; i++)
+    {
+        switch (code[i].opcode)
+        {
+        case OP_PUSH:
+            if (code[i].segment != SEG_CONSTANT && code[i].segment != SEG_LOCAL && code[i].segment != SEG_ARGUMENT && code[i].segment != SEG_STATIC)
+                return 0;
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_NEG:
+        case OP_AND:
+        case OP_OR:
+        case OP_NOT:
+            break;
+        default:
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int SameCode(Instruction* first, Instruction* second, int length)
+{
+    for (int i = 0; i < length; i++)
+    {
+        if (first[i].opcode != second[i].opcode || first[i].segment != second[i].segment || first[i].index != second[i].index)
+            return 0;
+    }
+
+    return 1;
+}
+
+/// @brief Checks if code pushes the location a pop writes.
+int ReadsLocation(Instruction* code, int length, Instruction* pop)
+{
+    for (int i = 0; i < length; i++)
+    {
+        if (code[i].opcode == OP_PUSH && code[i].segment == pop->segment && code[i].index == pop->index)
+            return 1;
+    }
+
+    return 0;
+}
+
+/// @brief Counts the later computations of the address from start to end in its basic block that find pointer 1 changed and would reload it from a temp.
+int CountTempReuses(Instruction* code, int length, int* addressEnds, int start, int end)
+{
+    int pointerIntact = 1;
+    int reuses = 0;
+
+    for (int i = end + 1; i < length; i++)
+    {
+        if (addressEnds[i] >= 0 && addressEnds[i] - i == end - start && SameCode(code + i, code + start, end - start))
+        {
+            reuses += !pointerIntact;
+            pointerIntact = 1;
+            i = addressEnds[i];
+            continue;
+        }
+
+        // Temps do not live across calls
+        if (code[i].opcode != OP_PUSH && code[i].opcode != OP_POP && code[i].opcode < OP_LABEL)
+            continue;
+
+        if (code[i].opcode != OP_PUSH && code[i].opcode != OP_POP)
+            break;
+
+        if (code[i].opcode == OP_POP && ReadsLocation(code + start, end - start, &code[i]))
+            break;
+
+        if (code[i].opcode == OP_POP && code[i].segment == SEG_POINTER && code[i].index == 1)
+            pointerIntact = 0;
+    }
+
+    return reuses;
+}
+
+int FindFreeTemp(AvailableAddress* available, int count)
+{
+    for (int temp = FIRST_CSE_TEMP; temp <= LAST_CSE_TEMP; temp++)
+    {
+        int used = 0;
+
+        for (int i = 0; i < count; i++)
+            used |= available[i].valid && available[i].temp == temp;
+
+        if (!used)
+            return temp;
+    }
+
+    return -1;
+}
+
+/// @brief Drops array address computations of a basic block whose value pointer 1 still holds, and reloads the ones computed again after pointer 1 changed from a temp.
+void ReuseAddresses(CodeBuffer* function)
+{
+    Instruction* code = function->code;
+    int length = function->length;
+    int* addressEnds = (int*)malloc(sizeof(int) * (length + 1));
+    CodeBuffer output = {NULL, 0, 0};
+    AvailableAddress available[MAX_AVAILABLE_ADDRESSES];
+    int availableCount = 0;
+    int pointerHolds = -1;
+
+    // Each pure expression popped to pointer 1 is marked by the index of its pop at its start
+    for (int i = 0; i < length; i++)
+        addressEnds[i] = -1;
+
+    for (int i = 0; i < length; i++)
+    {
+        if (code[i].opcode != OP_POP || code[i].segment != SEG_POINTER || code[i].index != 1)
+            continue;
+
+        int start = FindOperandStart(code, i);
+
+        if (start >= 0 && IsPureAddress(code, start, i))
+            addressEnds[start] = i;
+    }
+
+    for (int i = 0; i < length; i++)
+    {
+        Instruction* instruction = &code[i];
+
+        // Values computed before a label may not be there when it is jumped to
+        if (instruction->opcode == OP_LABEL || instruction->opcode == OP_FUNCTION)
+        {
+            availableCount = 0;
+            pointerHolds = -1;
+        }
+
+        if (addressEnds[i] >= 0)
+        {
+            int end = addressEnds[i];
+            int found = -1;
+
+            for (int j = 0; j < availableCount && found < 0; j++)
+            {
+                if (available[j].valid && available[j].length == end - i && SameCode(code + available[j].start, code + i, end - i))
+                    found = j;
+            }
+
+            if (found >= 0 && pointerHolds == found)
+            {
+                reusedAddresses++;
+                i = end;
+                continue;
+            }
+
+            if (found >= 0 && available[found].temp >= 0)
+            {
+                AppendInstruction(&output, OP_PUSH, SEG_TEMP, available[found].temp);
+                AppendInstruction(&output, OP_POP, SEG_POINTER, 1);
+                pointerHolds = found;
+                reusedAddresses++;
+                i = end;
+                continue;
+            }
+
+            ReserveInstructions(&output, end + 1 - i);
+            memcpy(output.code + output.length, code + i, sizeof(Instruction) * (end + 1 - i));
+            output.length += end + 1 - i;
+
+            if (found < 0 && availableCount < MAX_AVAILABLE_ADDRESSES)
+            {
+                found = availableCount++;
+                available[found].start = i;
+                available[found].length = end - i;
+                available[found].valid = 1;
+                available[found].temp = -1;
+            }
+
+            pointerHolds = found;
+
+            // Keeping the address costs a push and a pop, a reload saves all but one instruction of the expression
+            if (found >= 0 && CountTempReuses(code, length, addressEnds, i, end) * (end - i - 1) > 2)
+            {
+                int temp = FindFreeTemp(available, availableCount);
+
+                if (temp >= 0)
+                {
+                    AppendInstruction(&output, OP_PUSH, SEG_POINTER, 1);
+                    AppendInstruction(&output, OP_POP, SEG_TEMP, temp);
+                    available[found].temp = temp;
+                }
+            }
+
+            i = end;
+            continue;
+        }
+
+        ReserveInstructions(&output, 1);
+        output.code[output.length++] = *instruction;
+
+        if (instruction->opcode == OP_POP)
+        {
+            for (int j = 0; j < availableCount; j++)
+            {
+                if (ReadsLocation(code + available[j].start, available[j].length, instruction))
+                    available[j].valid = 0;
+
+                if (instruction->segment == SEG_TEMP && available[j].temp == instruction->index)
+                    available[j].temp = -1;
+            }
+
+            if (instruction->segment == SEG_POINTER && instruction->index == 1)
+                pointerHolds = -1;
+        }
+        else if (instruction->opcode == OP_CALL)
+        {
+            // The called function may write statics and temps, that is restored on return
+            for (int j = 0; j < availableCount; j++)
+            {
+                for (int k = 0; k < available[j].length; k++)
+                    available[j].valid &= code[available[j].start + k].segment != SEG_STATIC;
+
+                available[j].temp = -1;
+            }
+        }
+        else if (instruction->opcode == OP_GOTO || instruction->opcode == OP_IF_GOTO || instruction->opcode == OP_RETURN)
+        {
+            availableCount = 0;
+            pointerHolds = -1;
+        }
+
+        if (pointerHolds >= 0 && !available[pointerHolds].valid)
+            pointerHolds = -1;
+    }
+
+    free(addressEnds);
+    free(function->code);
+    *function = output;
+}
+
+int IsLabel(Instruction* instruction, Opcode opcode, int label, int number)
+{
+    return instruction->opcode == opcode && instruction->target == label && instruction->index == number;
+}
+
+/// @brief Counts the goto and if-goto instructions to a label.
+int CountJumps(Instruction* code, int length, LabelKind label, int number)
+{
+    int count = 0;
+
+    for (int i = 0; i < length; i++)
+    {
+        if (IsLabel(&code[i], OP_GOTO, label, number) || IsLabel(&code[i], OP_IF_GOTO, label, number))
+            count++;
+    }
+
+    return count;
+}
+
+/// @brief Checks if the value the code before end leaves on the stack is 0 or -1: a comparison, false, or not of one of them.
+int IsBoolean(Instruction* code, int end)
+{
+    if (end >= 1 && code[end - 1].opcode == OP_NOT)
+        end--;
+
+    if (end >= 1 && code[end - 1].opcode == OP_PUSH && code[end - 1].segment == SEG_CONSTANT && code[end - 1].index == 0)
+        return 1;
+
+    return end >= 1 && (code[end - 1].opcode == OP_EQ || code[end - 1].opcode == OP_GT || code[end - 1].opcode == OP_LT);
+}
+
+/// @brief Moves the test of the loop starting at the WHILE_EXP label at start to the bottom, so an iteration runs one branch instead of a not, a branch and a goto. Returns the new length, or the old one if the loop does not have the generated shape.
+int RotateLoop(Instruction* code, int length, int start)
+{
+    int number = code[start].index;
+    int test = start + 1;
+
+    while (test < length && !IsLabel(&code[test], OP_IF_GOTO, LABEL_WHILE_END, number))
+        test++;
+
+    // Only the not added by the compiler can be dropped, a condition ending in not lost it to the peephole optimizer.
+    // Jack's ~ is bitwise, so branching on the condition instead of on its not only agrees when the condition is 0 or -1.
+    if (test == length || test - 1 <= start || code[test - 1].opcode != OP_NOT || !IsBoolean(code, test - 1))
+        return length;
+
+    int back = test + 1;
+
+    while (back < length - 1 && !(IsLabel(&code[back], OP_GOTO, LABEL_WHILE_EXP, number) && IsLabel(&code[back + 1], OP_LABEL, LABEL_WHILE_END, number)))
+        back++;
+
+    // A body ending in return has lost its back jump
+    if (back >= length - 1 || CountJumps(code, length, LABEL_WHILE_EXP, number) != 1)
+        return length;
+
+    int conditionLength = test - 1 - (start + 1);
+    int bodyLength = back - (test + 1);
+    int keepEnd = CountJumps(code, length, LABEL_WHILE_END, number) > 1;
+    Instruction* condition = (Instruction*)malloc(sizeof(Instruction) * conditionLength);
+    memcpy(condition, code + start + 1, sizeof(Instruction) * conditionLength);
+
+    // goto WHILE_EXP, label WHILE_BODY, body, label WHILE_EXP, condition, if-goto WHILE_BODY
+    Instruction testLabel = code[start];
+    Instruction jump = testLabel;
+    jump.opcode = OP_GOTO;
+    Instruction bodyLabel = testLabel;
+    bodyLabel.target = LABEL_WHILE_BODY;
+    Instruction branch = bodyLabel;
+    branch.opcode = OP_IF_GOTO;
+    Instruction endLabel = code[back + 1];
+
+    memmove(code + start + 2, code + test + 1, sizeof(Instruction) * bodyLength);
+    code[start] = jump;
+    code[start + 1] = bodyLabel;
+
+    int write = start + 2 + bodyLength;
+    code[write++] = testLabel;
+    memcpy(code + write, condition, sizeof(Instruction) * conditionLength);
+    write += conditionLength;
+    code[write++] = branch;
+
+    if (keepEnd)
+        code[write++] = endLabel;
+
+    memmove(code + write, code + back + 2, sizeof(Instruction) * (length - back - 2));
+    free(condition);
+    branchesLaidOut++;
+
+    return write + length - back - 2;
+}
+
+/// @brief Branches straight to the else part of an if whose condition ends in not, and rotates while loops.
+int LayOutBranches(Instruction* code, int length)
+{
+    for (int i = 0; i < length; i++)
+    {
+        if (code[i].opcode == OP_LABEL && code[i].target == LABEL_WHILE_EXP)
+        {
+            length = RotateLoop(code, length, i);
+            continue;
+        }
+
+        // not, if-goto IF_TRUE, goto IF_FALSE, label IF_TRUE is if-goto IF_FALSE
+        if (i + 3 < length && code[i].opcode == OP_NOT && IsBoolean(code, i) && code[i + 1].opcode == OP_IF_GOTO && code[i + 1].target == LABEL_IF_TRUE
+            && IsLabel(&code[i + 2], OP_GOTO, LABEL_IF_FALSE, code[i + 1].index) && IsLabel(&code[i + 3], OP_LABEL, LABEL_IF_TRUE, code[i + 1].index)
+            && CountJumps(code, length, LABEL_IF_TRUE, code[i + 1].index) == 1)
+        {
+            code[i] = code[i + 2];
+            code[i].opcode = OP_IF_GOTO;
+            memmove(code + i + 1, code + i + 4, sizeof(Instruction) * (length - i - 4));
+            length -= 3;
+            branchesLaidOut++;
+        }
+    }
+
+    return length;
+}
+
+/// @brief Finds where the expression of the value on top of the stack at end starts, with the address an array read at its start pops to pointer 1.
+int FindExpressionStart(Instruction* code, int end)
+{
+    int start = FindOperandStart(code, end);
+
+    while (start > 0 && code[start].opcode == OP_PUSH && code[start].segment == SEG_THAT
+        && code[start - 1].opcode == OP_POP && code[start - 1].segment == SEG_POINTER && code[start - 1].index == 1)
+        start = FindOperandStart(code, start - 1);
+
+    return start;
+}
+
+/// @brief Checks if code can be skipped without a visible effect. Array reads set pointer 1, which the generated code sets again before every use until address reuse drops those sets.
+int IsPureOperand(Instruction* code, int start, int end)
+{
+    for (int i = start; i < end; i++)
+    {
+        if (code[i].opcode >= OP_LABEL)
+            return 0;
+
+        if (code[i].opcode == OP_POP && !(code[i].segment == SEG_POINTER && code[i].index == 1))
+            return 0;
+    }
+
+    return 1;
+}
+
+/// @brief Skips the pure right operand of and when the left one is false, and of or when it is true. Only a left operand that is 0 or -1 decides the result alone.
+void ShortCircuit(CodeBuffer* function)
+{
+    Instruction* code = function->code;
+    int length = function->length;
+    CodeBuffer output = {NULL, 0, 0};
+    int* outputStarts = (int*)malloc(sizeof(int) * length);
+    int andCount = 0;
+    int orCount = 0;
+
+    for (int i = 0; i < length; i++)
+    {
+        int rightStart = -1;
+        outputStarts[i] = output.length;
+
+        if (code[i].opcode == OP_AND || code[i].opcode == OP_OR)
+            rightStart = FindExpressionStart(code, i);
+
+        if (rightStart < 0 || i - rightStart < MIN_SHORT_CIRCUIT_LENGTH || !IsPureOperand(code, rightStart, i) || !IsBoolean(code, rightStart))
+        {
+            ReserveInstructions(&output, 1);
+            output.code[output.length++] = code[i];
+            continue;
+        }
+
+        // The right operand was already copied, with the and and or inside it expanded, it moves behind the branch
+        int rightOutput = outputStarts[rightStart];
+        int rightLength = output.length - rightOutput;
+        ReserveInstructions(&output, 9);
+
+        if (code[i].opcode == OP_AND)
+        {
+            // false and x is false, true and x is x
+            memmove(output.code + rightOutput + 4, output.code + rightOutput, sizeof(Instruction) * rightLength);
+            output.length = rightOutput;
+            AppendInstruction(&output, OP_IF_GOTO, SEG_NONE, andCount);
+            output.code[output.length - 1].target = LABEL_AND_TRUE;
+            AppendInstruction(&output, OP_PUSH, SEG_CONSTANT, 0);
+            AppendInstruction(&output, OP_GOTO, SEG_NONE, andCount);
+            output.code[output.length - 1].target = LABEL_AND_END;
+            AppendInstruction(&output, OP_LABEL, SEG_NONE, andCount);
+            output.code[output.length - 1].target = LABEL_AND_TRUE;
+            output.length += rightLength;
+            AppendInstruction(&output, OP_LABEL, SEG_NONE, andCount);
+            output.code[output.length - 1].target = LABEL_AND_END;
+            andCount++;
+        }
+        else
+        {
+            // true or x is true, false or x is x
+            memmove(output.code + rightOutput + 1, output.code + rightOutput, sizeof(Instruction) * rightLength);
+            output.length = rightOutput;
+            AppendInstruction(&output, OP_IF_GOTO, SEG_NONE, orCount);
+            output.code[output.length - 1].target = LABEL_OR_TRUE;
+            output.length += rightLength;
+            AppendInstruction(&output, OP_GOTO, SEG_NONE, orCount);
+            output.code[output.length - 1].target = LABEL_OR_END;
+            AppendInstruction(&output, OP_LABEL, SEG_NONE, orCount);
+            output.code[output.length - 1].target = LABEL_OR_TRUE;
+            AppendInstruction(&output, OP_PUSH, SEG_CONSTANT, 0);
+            AppendInstruction(&output, OP_NOT, SEG_NONE, 0);
+            AppendInstruction(&output, OP_LABEL, SEG_NONE, orCount);
+            output.code[output.length - 1].target = LABEL_OR_END;
+            orCount++;
+        }
+
+        shortCircuited++;
+    }
+
+    free(outputStarts);
+    free(function->code);
+    *function = output;
+}
+
+/// @brief Finds the constant the counter local is set to in the straight line code before start. Returns 0 if it is not set to a constant there.
+int FindCounterStart(Instruction* code, int start, int counter, int* value)
+{
+    for (int i = start - 1; i > 0; i--)
+    {
+        if (code[i].opcode >= OP_LABEL)
+            return 0;
+
+        if (code[i].opcode == OP_POP && code[i].segment == SEG_LOCAL && code[i].index == counter)
+            return ReadConstant(code, i, value) > 0;
+    }
+
+    return 0;
+}
+
+void AppendConstant(CodeBuffer* buffer, int value)
+{
+    ReserveInstructions(buffer, 2);
+    buffer->length += WriteConstant(buffer->code + buffer->length, value);
+}
+
+/// @brief Unrolls the loop whose WHILE_EXP label is at start if it counts a local from a constant to a constant bound by one. Returns where the code after the loop starts.
+int UnrollLoop(CodeBuffer* function, int start)
+{
+    Instruction* code = function->code;
+    int length = function->length;
+    int number = code[start].index;
+    int end = start + 1;
+
+    while (end < length && !IsLabel(&code[end], OP_LABEL, LABEL_WHILE_END, number))
+        end++;
+
+    // label WHILE_EXP, push local i, push constant bound, lt or gt, not, if-goto WHILE_END, body,
+    // push local i, push constant 1, add or sub, pop local i, goto WHILE_EXP, label WHILE_END
+    if (end == length || end - start < 11)
+        return start + 1;
+
+    Instruction* test = code + start + 1;
+    Instruction* step = code + end - 5;
+    int counter = test[0].index;
+    int up = test[2].opcode == OP_LT;
+    int first;
+
+    if (test[0].opcode != OP_PUSH || test[0].segment != SEG_LOCAL || test[1].opcode != OP_PUSH || test[1].segment != SEG_CONSTANT
+        || (test[2].opcode != OP_LT && test[2].opcode != OP_GT) || test[3].opcode != OP_NOT || !IsLabel(&test[4], OP_IF_GOTO, LABEL_WHILE_END, number))
+        return start + 1;
+
+    if (step[0].opcode != OP_PUSH || step[0].segment != SEG_LOCAL || step[0].index != counter || step[1].opcode != OP_PUSH || step[1].segment != SEG_CONSTANT || step[1].index != 1
+        || step[2].opcode != (up ? OP_ADD : OP_SUB) || step[3].opcode != OP_POP || step[3].segment != SEG_LOCAL || step[3].index != counter
+        || !IsLabel(&step[4], OP_GOTO, LABEL_WHILE_EXP, number))
+        return start + 1;
+
+    if (!FindCounterStart(code, start, counter, &first) || CountJumps(code, length, LABEL_WHILE_END, number) != 1 || CountJumps(code, length, LABEL_WHILE_EXP, number) != 1)
+        return start + 1;
+
+    // Copies of the body can not share labels, and the counter must only change by the step
+    Instruction* body = code + start + 6;
+    int bodyLength = end - 5 - (start + 6);
+
+    for (int i = 0; i < bodyLength; i++)
+    {
+        if (body[i].opcode >= OP_LABEL && body[i].opcode != OP_CALL)
+            return start + 1;
+
+        if (body[i].opcode == OP_POP && body[i].segment == SEG_LOCAL && body[i].index == counter)
+            return start + 1;
+    }
+
+    int tripCount = up ? test[1].index - first : first - test[1].index;
+    int direction = up ? 1 : -1;
+    int factor = 0;
+
+    if (tripCount < 0)
+        tripCount = 0;
+
+    if (tripCount * bodyLength <= UNROLL_BUDGET)
+    {
+        factor = tripCount;
+    }
+    else
+    {
+        // The test only runs every factor iterations, so it must not fall between them
+        for (int candidate = 4; candidate >= 2 && factor == 0; candidate /= 2)
+        {
+            if (tripCount % candidate == 0 && (candidate - 1) * (bodyLength + 4) <= UNROLL_BUDGET)
+                factor = candidate;
+        }
+
+        if (factor == 0)
+            return start + 1;
+    }
+
+    CodeBuffer output = {NULL, 0, 0};
+    ReserveInstructions(&output, start + length - end + factor * (bodyLength + 4) + 16);
+    memcpy(output.code, code, sizeof(Instruction) * start);
+    output.length = start;
+
+    if (factor == tripCount)
+    {
+        // Each copy sees the counter as a constant, the counter gets its value after the loop
+        for (int k = 0; k < tripCount; k++)
+        {
+            for (int i = 0; i < bodyLength; i++)
+            {
+                if (body[i].opcode == OP_PUSH && body[i].segment == SEG_LOCAL && body[i].index == counter)
+                    AppendConstant(&output, first + k * direction);
+                else
+                    output.code[output.length++] = body[i];
+            }
+        }
+
+        AppendConstant(&output, first + tripCount * direction);
+        AppendInstruction(&output, OP_POP, SEG_LOCAL, counter);
+    }
+    else
+    {
+        memcpy(output.code + output.length, code + start, sizeof(Instruction) * 6);
+        output.length += 6;
+
+        for (int k = 0; k < factor; k++)
+        {
+            ReserveInstructions(&output, bodyLength + 4);
+            memcpy(output.code + output.length, body, sizeof(Instruction) * (bodyLength + 4));
+            output.length += bodyLength + 4;
+        }
+
+        ReserveInstructions(&output, 2);
+        output.code[output.length++] = step[4];
+        output.code[output.length++] = code[end];
+    }
+
+    int next = output.length;
+    ReserveInstructions(&output, length - end - 1);
+    memcpy(output.code + output.length, code + end + 1, sizeof(Instruction) * (length - end - 1));
+    output.length += length - end - 1;
+
+    free(function->code);
+    *function = output;
+    unrolledLoops++;
+
+    return next;
+}
+
+/// @brief Unrolls the while loops of a function that run a constant number of times, inner loops first.
+void UnrollLoops(CodeBuffer* function)
+{
+    for (int i = function->length - 1; i > 0; i--)
+    {
+        if (function->code[i].opcode == OP_LABEL && function->code[i].target == LABEL_WHILE_EXP)
+            UnrollLoop(function, i);
+    }
+}
+
+/// @brief Checks if array code of the compiler uses locals past the frame of the function, their place depends on the local count.
+int UsesLocalsPastFrame(Instruction* code, int length)
+{
+    for (int i = 1; i < length; i++)
+    {
+        if (code[i].segment == SEG_LOCAL && code[i].index >= code[0].index)
+            return 1;
+    }
+
+    return 0;
+}
+
+/// @brief Checks if an instruction of the loop from start to end gives the same result in every iteration, without side effects.
+int IsInvariant(Instruction* code, int start, int end, Instruction* instruction, int hasCall, int writesObject)
+{
+    switch (instruction->opcode)
+    {
+    case OP_ADD:
+    case OP_SUB:
+    case OP_NEG:
+    case OP_EQ:
+    case OP_GT:
+    case OP_LT:
+    case OP_AND:
+    case OP_OR:
+    case OP_NOT:
+        return 1;
+    case OP_PUSH:
+        break;
+    default:
+        return 0;
+    }
+
+    switch (instruction->segment)
+    {
+    case SEG_CONSTANT:
+        return 1;
+    case SEG_LOCAL:
+    case SEG_ARGUMENT:
+        break;
+    case SEG_STATIC:
+        // The called function may write statics of its class
+        if (hasCall)
+            return 0;
+        break;
+    case SEG_THIS:
+        // that may point into this object, and a called function may write it
+        return !hasCall && !writesObject;
+    default:
+        return 0;
+    }
+
+    for (int i = start; i < end; i++)
+    {
+        if (code[i].opcode == OP_POP && code[i].segment == instruction->segment && code[i].index == instruction->index)
+            return 0;
+    }
+
+    return 1;
+}
+
+/// @brief Computes the invariant expressions of the loop whose WHILE_EXP label is at start into new locals before the label. Returns where the label is then.
+int HoistLoopInvariants(CodeBuffer* function, int start)
+{
+    Instruction* code = function->code;
+    int length = function->length;
+    int end = start + 1;
+
+    while (end < length && !IsLabel(&code[end], OP_LABEL, LABEL_WHILE_END, code[start].index))
+        end++;
+
+    if (end == length)
+        return start;
+
+    int hasCall = 0;
+    int writesObject = 0;
+
+    for (int i = start + 1; i < end; i++)
+    {
+        hasCall |= code[i].opcode == OP_CALL;
+        writesObject |= code[i].opcode == OP_POP && (code[i].segment == SEG_THIS || code[i].segment == SEG_THAT || (code[i].segment == SEG_POINTER && code[i].index == 0));
+    }
+
+    // Start of the invariant expression ending at each instruction, -1 if there is none with an operation
+    int* starts = (int*)malloc(sizeof(int) * (end - start));
+    int* locals = (int*)malloc(sizeof(int) * (end - start));
+
+    for (int i = start + 1; i < end; i++)
+    {
+        int expressionStart = FindOperandStart(code, i + 1);
+        starts[i - start] = -1;
+
+        if (expressionStart <= start || expressionStart == i)
+            continue;
+
+        int invariant = 1;
+        int constant = 1;
+
+        for (int j = expressionStart; j <= i && invariant; j++)
+        {
+            invariant = IsInvariant(code, start, end, &code[j], hasCall, writesObject);
+            constant &= code[j].opcode != OP_PUSH || code[j].segment == SEG_CONSTANT;
+        }
+
+        // Constants such as true are left to folding, hoisting them only pays if they run in every iteration
+        if (invariant && !constant)
+            starts[i - start] = expressionStart;
+    }
+
+    // Only the largest expressions are hoisted, the same one twice goes to one local
+    int hoisted = 0;
+    int inserted = 0;
+
+    for (int i = start + 1; i < end; i++)
+    {
+        int expressionStart = starts[i - start];
+        locals[i - start] = -1;
+
+        if (expressionStart < 0)
+            continue;
+
+        int largest = 1;
+
+        for (int j = i + 1; j < end && largest; j++)
+            largest = starts[j - start] < 0 || starts[j - start] > expressionStart;
+
+        if (!largest)
+            continue;
+
+        for (int j = start + 1; j < i && locals[i - start] < 0; j++)
+        {
+            if (locals[j - start] >= 0 && j - starts[j - start] == i - expressionStart && SameCode(code + starts[j - start], code + expressionStart, i + 1 - expressionStart))
+                locals[i - start] = locals[j - start];
+        }
+
+        if (locals[i - start] < 0)
+        {
+            locals[i - start] = code[0].index + hoisted++;
+            inserted += i + 2 - expressionStart;
+        }
+
+        hoistedExpressions++;
+    }
+
+    if (hoisted == 0)
+    {
+        free(starts);
+        free(locals);
+        return start;
+    }
+
+    CodeBuffer output = {NULL, 0, 0};
+    ReserveInstructions(&output, length + inserted);
+    memcpy(output.code, code, sizeof(Instruction) * start);
+    output.length = start;
+
+    int next = code[0].index;
+
+    for (int i = start + 1; i < end; i++)
+    {
+        if (locals[i - start] != next)
+            continue;
+
+        int expressionStart = starts[i - start];
+        memcpy(output.code + output.length, code + expressionStart, sizeof(Instruction) * (i + 1 - expressionStart));
+        output.length += i + 1 - expressionStart;
+        AppendInstruction(&output, OP_POP, SEG_LOCAL, next);
+        next++;
+    }
+
+    int label = output.length;
+
+    // Where each hoisted expression starting in the loop ends
+    int* ends = (int*)malloc(sizeof(int) * (end - start));
+
+    for (int i = start + 1; i < end; i++)
+        ends[i - start] = -1;
+
+    for (int i = start + 1; i < end; i++)
+    {
+        if (locals[i - start] >= 0)
+            ends[starts[i - start] - start] = i;
+    }
+
+    for (int i = start; i < length; i++)
+    {
+        if (i > start && i < end && ends[i - start] >= 0)
+        {
+            AppendInstruction(&output, OP_PUSH, SEG_LOCAL, locals[ends[i - start] - start]);
+            i = ends[i - start];
+            continue;
+        }
+
+        ReserveInstructions(&output, 1);
+        output.code[output.length++] = code[i];
+    }
+
+    output.code[0].index += hoisted;
+    free(starts);
+    free(locals);
+    free(ends);
+    free(function->code);
+    *function = output;
+
+    return label;
+}
+
+/// @brief Hoists invariant expressions out of the while loops of a function, outer loops first.
+void HoistInvariants(CodeBuffer* function)
+{
+    if (function->code[0].opcode != OP_FUNCTION || UsesLocalsPastFrame(function->code, function->length))
+        return;
+
+    for (int i = 1; i < function->length; i++)
+    {
+        if (function->code[i].opcode == OP_LABEL && function->code[i].target == LABEL_WHILE_EXP)
+            i = HoistLoopInvariants(function, i);
+    }
+}
+
+/// @brief Finds the block that starts with the label a jump goes to.
+int FindBlock(Instruction* code, int* blockStarts, int blockCount, Instruction* jump)
+{
+    for (int i = 0; i < blockCount; i++)
+    {
+        if (IsLabel(&code[blockStarts[i]], OP_LABEL, (LabelKind)jump->target, jump->index))
+            return i;
+    }
+
+    return -1;
+}
+
+/// @brief Marks a local written while the locals in live hold values as sharing no slot with them.
+void AddInterference(char* interferes, int localCount, char* live, int local)
+{
+    for (int i = 0; i < localCount; i++)
+    {
+        if (live[i] && i != local)
+        {
+            interferes[local * localCount + i] = 1;
+            interferes[i * localCount + local] = 1;
+        }
+    }
+}
+
+/// @brief Gives locals that never hold values at the same time one slot, drops unused ones and lowers the local count of the function.
+void PackLocals(Instruction* code, int length)
+{
+    int localCount = code[0].index;
+
+    if (code[0].opcode != OP_FUNCTION || localCount == 0 || UsesLocalsPastFrame(code, length))
+        return;
+
+    // Blocks start at the function, at labels and after jumps and returns
+    int* blockStarts = (int*)malloc(sizeof(int) * (length + 1));
+    int blockCount = 0;
+
+    for (int i = 0; i < length; i++)
+    {
+        int previous = i > 0 ? code[i - 1].opcode : OP_FUNCTION;
+
+        if (i == 0 || code[i].opcode == OP_LABEL || previous == OP_GOTO || previous == OP_IF_GOTO || previous == OP_RETURN)
+            blockStarts[blockCount++] = i;
+    }
+
+    blockStarts[blockCount] = length;
+
+    // Locals each block reads before writing, and locals live at its start and end
+    char* uses = (char*)calloc(blockCount * localCount, 1);
+    char* writes = (char*)calloc(blockCount * localCount, 1);
+    char* liveIn = (char*)calloc(blockCount * localCount, 1);
+    char* liveOut = (char*)calloc(blockCount * localCount, 1);
+    char* live = (char*)malloc(localCount);
+    char* interferes = (char*)calloc(localCount * localCount, 1);
+    char* used = (char*)calloc(localCount, 1);
+    int* slots = (int*)malloc(sizeof(int) * localCount);
+
+    for (int block = 0; block < blockCount; block++)
+    {
+        for (int i = blockStarts[block + 1] - 1; i >= blockStarts[block]; i--)
+        {
+            if (code[i].segment != SEG_LOCAL)
+                continue;
+
+            int local = block * localCount + code[i].index;
+            used[code[i].index] = 1;
+
+            if (code[i].opcode == OP_POP)
+            {
+                writes[local] = 1;
+                uses[local] = 0;
+            }
+            else
+            {
+                uses[local] = 1;
+            }
+        }
+    }
+
+    int changed = 1;
+
+    while (changed)
+    {
+        changed = 0;
+
+        for (int block = blockCount - 1; block >= 0; block--)
+        {
+            Instruction* last = &code[blockStarts[block + 1] - 1];
+            int successors[2] = {-1, -1};
+
+            if (last->opcode == OP_GOTO || last->opcode == OP_IF_GOTO)
+                successors[0] = FindBlock(code, blockStarts, blockCount, last);
+
+            if (last->opcode != OP_GOTO && last->opcode != OP_RETURN && block + 1 < blockCount)
+                successors[1] = block + 1;
+
+            for (int local = 0; local < localCount; local++)
+            {
+                char* out = &liveOut[block * localCount + local];
+
+                for (int i = 0; i < 2; i++)
+                {
+                    if (successors[i] >= 0 && liveIn[successors[i] * localCount + local] && !*out)
+                    {
+                        *out = 1;
+                        changed = 1;
+                    }
+                }
+
+                int in = uses[block * localCount + local] || (*out && !writes[block * localCount + local]);
+
+                if (in && !liveIn[block * localCount + local])
+                {
+                    liveIn[block * localCount + local] = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    for (int block = 0; block < blockCount; block++)
+    {
+        memcpy(live, &liveOut[block * localCount], localCount);
+
+        for (int i = blockStarts[block + 1] - 1; i >= blockStarts[block]; i--)
+        {
+            if (code[i].segment != SEG_LOCAL)
+                continue;
+
+            if (code[i].opcode == OP_POP)
+            {
+                AddInterference(interferes, localCount, live, code[i].index);
+                live[code[i].index] = 0;
+            }
+            else
+            {
+                live[code[i].index] = 1;
+            }
+        }
+    }
+
+    // The function sets all locals to 0, so the ones read before written hold values together from the start
+    for (int local = 0; local < localCount; local++)
+    {
+        if (liveIn[local])
+            AddInterference(interferes, localCount, liveIn, local);
+    }
+
+    int slotCount = 0;
+
+    for (int local = 0; local < localCount; local++)
+    {
+        slots[local] = -1;
+
+        if (!used[local])
+            continue;
+
+        int slot = 0;
+        int taken = 1;
+
+        while (taken)
+        {
+            taken = 0;
+
+            for (int other = 0; other < local && !taken; other++)
+                taken = interferes[local * localCount + other] && slots[other] == slot;
+
+            if (taken)
+                slot++;
+        }
+
+        slots[local] = slot;
+
+        if (slot + 1 > slotCount)
+            slotCount = slot + 1;
+    }
+
+    for (int i = 1; i < length; i++)
+    {
+        if (code[i].segment == SEG_LOCAL)
+            code[i].index = slots[code[i].index];
+    }
+
+    removedLocals += localCount - slotCount;
+    code[0].index = slotCount;
+
+    free(blockStarts);
+    free(uses);
+    free(writes);
+    free(liveIn);
+    free(liveOut);
+    free(live);
+    free(interferes);
+    free(used);
+    free(slots);
+}
+
+void AppendLabel(CodeBuffer* buffer, Opcode opcode, LabelKind label, int number)
+{
+    AppendInstruction(buffer, opcode, SEG_NONE, number);
+    buffer->code[buffer->length - 1].target = label;
+}
+
+/// @brief Replaces calls of Memory.peek, Memory.poke, Math.abs, Math.min and Math.max with the code of the OS functions.
+void ExpandIntrinsics(CodeBuffer* function)
+{
+    Instruction* code = function->code;
+    int length = function->length;
+    CodeBuffer output = {NULL, 0, 0};
+    int labelCount = 0;
+
+    for (int i = 0; i < length; i++)
+    {
+        Instruction* instruction = &code[i];
+
+        if (IsOsCall(instruction, "Memory", "peek", 1))
+        {
+            AppendInstruction(&output, OP_POP, SEG_POINTER, 1);
+            AppendInstruction(&output, OP_PUSH, SEG_THAT, 0);
+        }
+        else if (IsOsCall(instruction, "Memory", "poke", 2))
+        {
+            AppendInstruction(&output, OP_POP, SEG_TEMP, 0);
+            AppendInstruction(&output, OP_POP, SEG_POINTER, 1);
+            AppendInstruction(&output, OP_PUSH, SEG_TEMP, 0);
+            AppendInstruction(&output, OP_POP, SEG_THAT, 0);
+
+            // A do statement drops the returned 0 right away
+            if (i + 1 < length && code[i + 1].opcode == OP_POP && code[i + 1].segment == SEG_TEMP && code[i + 1].index == 0)
+                i++;
+            else
+                AppendInstruction(&output, OP_PUSH, SEG_CONSTANT, 0);
+        }
+        else if (IsOsCall(instruction, "Math", "abs", 1))
+        {
+            // An argument that is one push is pushed again, anything else is kept in temp 0
+            Instruction value = {OP_PUSH, SEG_TEMP, 0, 0};
+            Instruction* last = output.length > 0 ? &output.code[output.length - 1] : NULL;
+
+            if (last != NULL && last->opcode == OP_PUSH && last->segment != SEG_THAT && last->segment != SEG_POINTER && last->segment != SEG_TEMP)
+            {
+                value = *last;
+            }
+            else
+            {
+                AppendInstruction(&output, OP_POP, SEG_TEMP, 0);
+                AppendInstruction(&output, OP_PUSH, SEG_TEMP, 0);
+            }
+
+            AppendInstruction(&output, OP_PUSH, SEG_CONSTANT, 0);
+            AppendInstruction(&output, OP_LT, SEG_NONE, 0);
+            AppendLabel(&output, OP_IF_GOTO, LABEL_INTRINSIC_TRUE, labelCount);
+            AppendInstruction(&output, OP_PUSH, (Segment)value.segment, value.index);
+            AppendLabel(&output, OP_GOTO, LABEL_INTRINSIC_END, labelCount);
+            AppendLabel(&output, OP_LABEL, LABEL_INTRINSIC_TRUE, labelCount);
+            AppendInstruction(&output, OP_PUSH, (Segment)value.segment, value.index);
+            AppendInstruction(&output, OP_NEG, SEG_NONE, 0);
+            AppendLabel(&output, OP_LABEL, LABEL_INTRINSIC_END, labelCount);
+            labelCount++;
+        }
+        else if (IsMathCall(instruction, "min") || IsMathCall(instruction, "max"))
+        {
+            // a < b picks a for min, a > b picks a for max
+            AppendInstruction(&output, OP_POP, SEG_TEMP, 1);
+            AppendInstruction(&output, OP_POP, SEG_TEMP, 0);
+            AppendInstruction(&output, OP_PUSH, SEG_TEMP, 0);
+            AppendInstruction(&output, OP_PUSH, SEG_TEMP, 1);
+            AppendInstruction(&output, IsMathCall(instruction, "min") ? OP_LT : OP_GT, SEG_NONE, 0);
+            AppendLabel(&output, OP_IF_GOTO, LABEL_INTRINSIC_TRUE, labelCount);
+            AppendInstruction(&output, OP_PUSH, SEG_TEMP, 1);
+            AppendLabel(&output, OP_GOTO, LABEL_INTRINSIC_END, labelCount);
+            AppendLabel(&output, OP_LABEL, LABEL_INTRINSIC_TRUE, labelCount);
+            AppendInstruction(&output, OP_PUSH, SEG_TEMP, 0);
+            AppendLabel(&output, OP_LABEL, LABEL_INTRINSIC_END, labelCount);
+            labelCount++;
+        }
+        else
+        {
+            ReserveInstructions(&output, 1);
+            output.code[output.length++] = *instruction;
+            continue;
+        }
+
+        expandedIntrinsics++;
+    }
+
+    free(function->code);
+    *function = output;
+}
+
+/// @brief Returns how many instructions from i make a call of the function itself whose result is returned, 0 if the call at i is not one.
+int TailCallLength(Instruction* code, int length, int i, int voidResults)
+{
+    if (code[i].opcode != OP_CALL || code[i].target != code[0].target)
+        return 0;
+
+    if (i + 1 < length && code[i + 1].opcode == OP_RETURN)
+        return 2;
+
+    // do f(); return; returns what f returns when every return of f is 0
+    if (voidResults && i + 3 < length && code[i + 1].opcode == OP_POP && code[i + 1].segment == SEG_TEMP && code[i + 2].opcode == OP_PUSH
+        && code[i + 2].segment == SEG_CONSTANT && code[i + 2].index == 0 && code[i + 3].opcode == OP_RETURN)
+        return 4;
+
+    return 0;
+}
+
+/// @brief Turns calls of a function to itself whose result is returned into a jump to its start, with the arguments stored over its own.
+void EliminateTailCalls(CodeBuffer* function)
+{
+    Instruction* code = function->code;
+    int length = function->length;
+    int voidResults = 1;
+    int found = 0;
+
+    if (code[0].opcode != OP_FUNCTION)
+        return;
+
+    for (int i = 1; i < length; i++)
+    {
+        if (code[i].opcode == OP_RETURN)
+            voidResults &= code[i - 1].opcode == OP_PUSH && code[i - 1].segment == SEG_CONSTANT && code[i - 1].index == 0;
+    }
+
+    for (int i = 1; i < length && !found; i++)
+        found = TailCallLength(code, length, i, voidResults) > 0;
+
+    if (!found)
+        return;
+
+    CodeBuffer output = {NULL, 0, 0};
+    AppendInstruction(&output, OP_FUNCTION, SEG_NONE, code[0].index);
+    output.code[0].target = code[0].target;
+    AppendLabel(&output, OP_LABEL, LABEL_TAIL_CALL, 0);
+
+    for (int i = 1; i < length; i++)
+    {
+        int tailLength = TailCallLength(code, length, i, voidResults);
+
+        if (tailLength == 0)
+        {
+            ReserveInstructions(&output, 1);
+            output.code[output.length++] = code[i];
+            continue;
+        }
+
+        // The pushed arguments replace the old ones, and the locals start at 0 again
+        for (int argument = code[i].index - 1; argument >= 0; argument--)
+            AppendInstruction(&output, OP_POP, SEG_ARGUMENT, argument);
+
+        for (int local = 0; local < code[0].index; local++)
+        {
+            AppendInstruction(&output, OP_PUSH, SEG_CONSTANT, 0);
+            AppendInstruction(&output, OP_POP, SEG_LOCAL, local);
+        }
+
+        AppendLabel(&output, OP_GOTO, LABEL_TAIL_CALL, 0);
+        eliminatedTailCalls++;
+        i += tailLength - 1;
+    }
+
+    free(function->code);
+    *function = output;
+}
+
+/// @brief Runs the enabled passes over one function, from its function instruction to the next one.
+void OptimizeFunction(CodeBuffer* function)
+{
+    if (IsOptimizationEnabled(OPT_INTRINSICS))
+        ExpandIntrinsics(function);
+
+    if (IsOptimizationEnabled(OPT_FOLD))
+        function->length = FoldConstants(function->code, function->length);
+
+    if (IsOptimizationEnabled(OPT_STRENGTH))
+        ReduceStrength(function);
+
+    if (IsOptimizationEnabled(OPT_PEEPHOLE))
+        function->length = Peephole(function->code, function->length);
+
+    if (IsOptimizationEnabled(OPT_TAIL_CALLS))
+        EliminateTailCalls(function);
+
+    // Copies of the body with the counter as a constant leave work for the peephole optimizer
+    if (IsOptimizationEnabled(OPT_UNROLL))
+    {
+        UnrollLoops(function);
+
+        if (IsOptimizationEnabled(OPT_PEEPHOLE))
+            function->length = Peephole(function->code, function->length);
+    }
+
+    // Before address reuse, which drops the sets of pointer 1 that the code after a skipped operand would rely on
+    if (IsOptimizationEnabled(OPT_SHORT_CIRCUIT))
+        ShortCircuit(function);
+
+    if (IsOptimizationEnabled(OPT_CSE))
+        ReuseAddresses(function);
+
+    if (IsOptimizationEnabled(OPT_LICM))
+        HoistInvariants(function);
+
+    if (IsOptimizationEnabled(OPT_BRANCHES))
+        function->length = LayOutBranches(function->code, function->length);
+
+    if (IsOptimizationEnabled(OPT_LOCALS))
+        PackLocals(function->code, function->length);
+}
+
+/// @brief Optimizes the instructions of a file function by function into a new array that replaces the old one.
+void OptimizeCode(Instruction** code, int* count, int* capacity)
+{
+    CodeBuffer output = {NULL, 0, 0};
+    CodeBuffer function = {NULL, 0, 0};
+    int start = 0;
+
+    instructionsBefore += *count;
+
+    while (start < *count)
+    {
+        int end = start + 1;
+
+        while (end < *count && (*code)[end].opcode != OP_FUNCTION)
+            end++;
+
+        function.length = 0;
+        ReserveInstructions(&function, end - start);
+        memcpy(function.code, *code + start, sizeof(Instruction) * (end - start));
+        function.length = end - start;
+
+        OptimizeFunction(&function);
+
+        ReserveInstructions(&output, function.length);
+        memcpy(output.code + output.length, function.code, sizeof(Instruction) * function.length);
+        output.length += function.length;
+        start = end;
+    }
+
+    free(function.code);
+    free(*code);
+
+    *code = output.code;
+    *count = output.length;
+    *capacity = output.capacity;
+    instructionsAfter += output.length;
+}
+
+/// @brief Finds where each function is defined in the held files, indexed by function name id.
+FunctionSpan* FindFunctionSpans(GeneratedFile* files, int fileCount, int nameCount)
+{
+    FunctionSpan* spans = (FunctionSpan*)malloc(sizeof(FunctionSpan) * nameCount);
+
+    for (int i = 0; i < nameCount; i++)
+        spans[i].file = -1;
+
+    for (int file = 0; file < fileCount; file++)
+    {
+        Instruction* code = files[file].code;
+
+        for (int start = 0; start < files[file].count; start++)
+        {
+            if (code[start].opcode != OP_FUNCTION)
+                continue;
+
+            int end = start + 1;
+
+            while (end < files[file].count && code[end].opcode != OP_FUNCTION)
+                end++;
+
+            spans[code[start].target].file = file;
+            spans[code[start].target].start = start;
+            spans[code[start].target].end = end;
+        }
+    }
+
+    return spans;
+}
+
+/// @brief Checks if a function is a short leaf without branches that ends in its only return.
+/// Locals past its frame would become locals of the caller, which hold other values.
+int IsInlineCandidate(Instruction* function, int length)
+{
+    if (length < 2 || length - 2 > inlineSizeLimit || function[length - 1].opcode != OP_RETURN || UsesLocalsPastFrame(function, length))
+        return 0;
+
+    for (int i = 1; i < length - 1; i++)
+    {
+        switch (function[i].opcode)
+        {
+        case OP_LABEL:
+        case OP_GOTO:
+        case OP_IF_GOTO:
+        case OP_FUNCTION:
+        case OP_CALL:
+        case OP_RETURN:
+            return 0;
+        default:
+            break;
+        }
+    }
+
+    return 1;
+}
+
+/// @brief Appends the body of a function in place of a call to it. Arguments and locals of the function go to caller locals from base, this and that are restored as return would. Returns the number of caller locals used.
+int AppendInlinedBody(CodeBuffer* buffer, Instruction* function, int length, int argumentCount, int base)
+{
+    Instruction* body = function + 1;
+    int bodyLength = length - 2;
+    int localCount = function[0].index;
+    int slot = base + argumentCount + localCount;
+    int pointerSlots[2] = {-1, -1};
+    int argumentUses = 0;
+    int first = 0;
+
+    for (int i = 0; i < bodyLength; i++)
+    {
+        if (body[i].segment == SEG_ARGUMENT)
+            argumentUses++;
+
+        if (body[i].opcode == OP_POP && body[i].segment == SEG_POINTER && pointerSlots[body[i].index] < 0)
+            pointerSlots[body[i].index] = slot++;
+    }
+
+    // Saving this and that leaves the arguments on the stack
+    for (int i = 0; i < 2; i++)
+    {
+        if (pointerSlots[i] >= 0)
+        {
+            AppendInstruction(buffer, OP_PUSH, SEG_POINTER, i);
+            AppendInstruction(buffer, OP_POP, SEG_LOCAL, pointerSlots[i]);
+        }
+    }
+
+    // A single argument read once at the start is used where the call left it
+    if (argumentCount == 1 && argumentUses == 1 && bodyLength > 0 && body[0].opcode == OP_PUSH && body[0].segment == SEG_ARGUMENT)
+    {
+        first = 1;
+    }
+    else
+    {
+        for (int i = argumentCount - 1; i >= 0; i--)
+            AppendInstruction(buffer, OP_POP, SEG_LOCAL, base + i);
+    }
+
+    // Locals start as 0 like the function instruction sets them
+    for (int i = 0; i < localCount; i++)
+    {
+        AppendInstruction(buffer, OP_PUSH, SEG_CONSTANT, 0);
+        AppendInstruction(buffer, OP_POP, SEG_LOCAL, base + argumentCount + i);
+    }
+
+    for (int i = first; i < bodyLength; i++)
+    {
+        if (body[i].segment == SEG_ARGUMENT)
+            AppendInstruction(buffer, (Opcode)body[i].opcode, SEG_LOCAL, base + body[i].index);
+        else if (body[i].segment == SEG_LOCAL)
+            AppendInstruction(buffer, (Opcode)body[i].opcode, SEG_LOCAL, base + argumentCount + body[i].index);
+        else
+            AppendInstruction(buffer, (Opcode)body[i].opcode, (Segment)body[i].segment, body[i].index);
+    }
+
+    // The returned value stays on top of the stack
+    for (int i = 0; i < 2; i++)
+    {
+        if (pointerSlots[i] >= 0)
+        {
+            AppendInstruction(buffer, OP_PUSH, SEG_LOCAL, pointerSlots[i]);
+            AppendInstruction(buffer, OP_POP, SEG_POINTER, i);
+        }
+    }
+
+    return slot - base;
+}
+
+/// @brief Replaces calls of short leaf functions with their bodies, across all files of the program.
+void InlineFunctions(GeneratedFile* files, int fileCount)
+{
+    int nameCount = GetFunctionNameCount();
+    FunctionSpan* spans = FindFunctionSpans(files, fileCount, nameCount);
+    char* inlinable = (char*)calloc(nameCount, 1);
+    CodeBuffer* outputs = (CodeBuffer*)calloc(fileCount, sizeof(CodeBuffer));
+
+    for (int i = 0; i < nameCount; i++)
+    {
+        if (spans[i].file >= 0)
+            inlinable[i] = IsInlineCandidate(files[spans[i].file].code + spans[i].start, spans[i].end - spans[i].start);
+    }
+
+    for (int file = 0; file < fileCount; file++)
+    {
+        Instruction* code = files[file].code;
+        CodeBuffer* output = &outputs[file];
+        int functionStart = -1;
+        int scratchLocals = 0;
+        int pastFrame = 0;
+
+        for (int i = 0; i < files[file].count; i++)
+        {
+            Instruction* instruction = &code[i];
+
+            if (instruction->opcode == OP_FUNCTION)
+            {
+                // Locals used by inlined bodies are added to the previous function
+                if (functionStart >= 0)
+                    output->code[functionStart].index += scratchLocals;
+
+                functionStart = output->length;
+                scratchLocals = 0;
+                // Scratch locals would move the locals array code uses past the frame
+                pastFrame = UsesLocalsPastFrame(instruction, spans[instruction->target].end - i);
+            }
+            else if (instruction->opcode == OP_CALL && functionStart >= 0 && inlinable[instruction->target] && !pastFrame)
+            {
+                FunctionSpan* span = &spans[instruction->target];
+                Instruction* function = files[span->file].code + span->start;
+                int length = span->end - span->start;
+                int usesStatic = 0;
+
+                for (int j = 0; j < length; j++)
+                    usesStatic |= function[j].segment == SEG_STATIC;
+
+                // Statics belong to the file of the function
+                if (!usesStatic || span->file == file)
+                {
+                    int callerLocals = output->code[functionStart].index;
+                    int used = AppendInlinedBody(output, function, length, instruction->index, callerLocals);
+
+                    if (used > scratchLocals)
+                        scratchLocals = used;
+
+                    inlinedCalls++;
+                    continue;
+                }
+            }
+
+            AppendInstruction(output, (Opcode)instruction->opcode, (Segment)instruction->segment, instruction->index);
+            output->code[output->length - 1].target = instruction->target;
+        }
+
+        if (functionStart >= 0)
+            output->code[functionStart].index += scratchLocals;
+    }
+
+    // Function bodies are read from the old code until every file is done
+    for (int file = 0; file < fileCount; file++)
+    {
+        instructionsAfter += outputs[file].length - files[file].count;
+        free(files[file].code);
+        files[file].code = outputs[file].code;
+        files[file].count = outputs[file].length;
+    }
+
+    free(spans);
+    free(inlinable);
+    free(outputs);
+}
+
+/// @brief Marks the functions called by one function as reachable and queues the ones not marked before.
+void MarkCalledFunctions(GeneratedFile* files, FunctionSpan* spans, int nameId, char* reachable, int* worklist, int* worklistLength)
+{
+    Instruction* code = files[spans[nameId].file].code;
+
+    for (int i = spans[nameId].start; i < spans[nameId].end; i++)
+    {
+        int callee = code[i].target;
+
+        // Calls of the OS are not defined in the program
+        if (code[i].opcode != OP_CALL || reachable[callee] || spans[callee].file < 0)
+            continue;
+
+        reachable[callee] = 1;
+        worklist[(*worklistLength)++] = callee;
+    }
+}
+
+void RecordRemovedFunction(char* className, int instructions)
+{
+    removedFunctions++;
+
+    for (int i = 0; i < removedClassCount; i++)
+    {
+        if (strcmp(removedCode[i].className, className) == 0)
+        {
+            removedCode[i].functions++;
+            removedCode[i].instructions += instructions;
+            return;
+        }
+    }
+
+    removedCode = (RemovedCode*)realloc(removedCode, sizeof(RemovedCode) * (removedClassCount + 1));
+    removedCode[removedClassCount].className = className;
+    removedCode[removedClassCount].functions = 1;
+    removedCode[removedClassCount].instructions = instructions;
+    removedClassCount++;
+}
+
+/// @brief Removes the functions that can not be reached by calls from Main.main or Sys.init, across all files of the program.
+void EliminateDeadFunctions(GeneratedFile* files, int fileCount)
+{
+    int roots[2] = {GetFunctionNameId("Main", "main"), GetFunctionNameId("Sys", "init")};
+    int nameCount = GetFunctionNameCount();
+    FunctionSpan* spans = FindFunctionSpans(files, fileCount, nameCount);
+    char* reachable = (char*)calloc(nameCount, 1);
+    int* worklist = (int*)malloc(sizeof(int) * nameCount);
+    int worklistLength = 0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (spans[roots[i]].file >= 0)
+        {
+            reachable[roots[i]] = 1;
+            worklist[worklistLength++] = roots[i];
+        }
+    }
+
+    // Without an entry point every function may be called from outside
+    if (worklistLength > 0)
+    {
+        while (worklistLength > 0)
+            MarkCalledFunctions(files, spans, worklist[--worklistLength], reachable, worklist, &worklistLength);
+
+        for (int file = 0; file < fileCount; file++)
+        {
+            Instruction* code = files[file].code;
+            int length = 0;
+            int keep = 1;
+
+            for (int i = 0; i < files[file].count; i++)
+            {
+                if (code[i].opcode == OP_FUNCTION)
+                {
+                    FunctionSpan* span = &spans[code[i].target];
+                    keep = reachable[code[i].target];
+
+                    if (!keep)
+                        RecordRemovedFunction(GetFunctionName(code[i].target)->className, span->end - span->start);
+                }
+
+                if (keep)
+                    code[length++] = code[i];
+            }
+
+            instructionsAfter -= files[file].count - length;
+            files[file].count = length;
+        }
+    }
+
+    free(spans);
+    free(reachable);
+    free(worklist);
+}
+
+void ResetOptimizationReport()
+{
+    instructionsBefore = 0;
+    instructionsAfter = 0;
+    peepholeRemoved = 0;
+    foldedOperations = 0;
+    reducedOperations = 0;
+    branchesLaidOut = 0;
+    reusedAddresses = 0;
+    removedLocals = 0;
+    hoistedExpressions = 0;
+    unrolledLoops = 0;
+    shortCircuited = 0;
+    expandedIntrinsics = 0;
+    eliminatedTailCalls = 0;
+    inlinedCalls = 0;
+    removedFunctions = 0;
+    free(removedCode);
+    removedCode = NULL;
+    removedClassCount = 0;
+}
+
+void PrintOptimizationReport()
+{
+    if (optimizationFlags == 0)
+        return;
+
+    printf("Optimized %d instructions to %d.\n", instructionsBefore, instructionsAfter);
+
+    if (IsOptimizationEnabled(OPT_PEEPHOLE))
+        printf("Peephole optimizer removed %d instructions.\n", peepholeRemoved);
+
+    if (IsOptimizationEnabled(OPT_FOLD))
+        printf("Constant folding folded %d operations.\n", foldedOperations);
+
+    if (IsOptimizationEnabled(OPT_STRENGTH))
+        printf("Strength reduction replaced %d multiply and divide calls.\n", reducedOperations);
+
+    if (IsOptimizationEnabled(OPT_INTRINSICS))
+        printf("Intrinsics replaced %d calls.\n", expandedIntrinsics);
+
+    if (IsOptimizationEnabled(OPT_TAIL_CALLS))
+        printf("Tail call elimination replaced %d calls.\n", eliminatedTailCalls);
+
+    if (IsOptimizationEnabled(OPT_UNROLL))
+        printf("Loop unrolling unrolled %d loops.\n", unrolledLoops);
+
+    if (IsOptimizationEnabled(OPT_CSE))
+        printf("Common subexpression elimination reused %d array addresses.\n", reusedAddresses);
+
+    if (IsOptimizationEnabled(OPT_LICM))
+        printf("Loop-invariant code motion hoisted %d expressions.\n", hoistedExpressions);
+
+    if (IsOptimizationEnabled(OPT_SHORT_CIRCUIT))
+        printf("Short-circuit lowering skipped %d right operands.\n", shortCircuited);
+
+    if (IsOptimizationEnabled(OPT_BRANCHES))
+        printf("Branch layout changed %d branches and loops.\n", branchesLaidOut);
+
+    if (IsOptimizationEnabled(OPT_LOCALS))
+        printf("Local slot reuse removed %d locals.\n", removedLocals);
+
+    if (IsOptimizationEnabled(OPT_INLINE))
+        printf("Inlining replaced %d calls.\n", inlinedCalls);
+
+    if (IsOptimizationEnabled(OPT_DEAD_FUNCTIONS))
+    {
+        printf("Dead function elimination removed %d functions.\n", removedFunctions);
+
+        for (int i = 0; i < removedClassCount; i++)
+            printf("    %s: %d functions, %d instructions\n", removedCode[i].className, removedCode[i].functions, removedCode[i].instructions);
+    }
+}
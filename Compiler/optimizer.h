@@ -0,0 +1,36 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "codegeneration.h"
+
+// Optimization passes over the generated instructions, none of them run unless enabled
+typedef enum
+{
+    OPT_PEEPHOLE = 1 << 0,
+    OPT_FOLD = 1 << 1,
+    OPT_STRENGTH = 1 << 2,
+    OPT_DEAD_FUNCTIONS = 1 << 4,
+    OPT_INLINE = 1 << 5,
+    OPT_BRANCHES = 1 << 6,
+    OPT_CSE = 1 << 7,
+    OPT_LOCALS = 1 << 8,
+    OPT_LICM = 1 << 9,
+    OPT_UNROLL = 1 << 10,
+    OPT_SHORT_CIRCUIT = 1 << 11,
+    OPT_TAIL_CALLS = 1 << 13,
+    OPT_ALL = OPT_PEEPHOLE | OPT_FOLD | OPT_STRENGTH | OPT_DEAD_FUNCTIONS | OPT_INLINE | OPT_BRANCHES | OPT_CSE | OPT_LOCALS | OPT_LICM | OPT_UNROLL
+        | OPT_SHORT_CIRCUIT | OPT_TAIL_CALLS,
+    OPT_STRINGS = 1 << 3,   // not part of -O, pooled literals are shared String objects
+    OPT_INTRINSICS = 1 << 12 // not part of -O, assumes the OS Memory and Math of the standard library
+} OptimizationFlags;
+
+int ParseOptimizationFlag(char* argument);
+void SetOptimizations(int flags);
+int IsOptimizationEnabled(OptimizationFlags flag);
+void OptimizeCode(Instruction** code, int* count, int* capacity);
+void InlineFunctions(GeneratedFile* files, int fileCount);
+void EliminateDeadFunctions(GeneratedFile* files, int fileCount);
+void ResetOptimizationReport();
+void PrintOptimizationReport();
+
+#endif
@@ -14,7 +14,7 @@ void Error(ParserInfo* parserInfo, Token* token, SyntaxErrors syntaxError, char*
 static void PrintErrorCombine(char* errorMessage, ParserInfo* parserInfo);
 Token GetNextTokenWithErrorCheck(ParserInfo *pi);
 Token PeekNextTokenWithErrorCheck(ParserInfo *pi);
-Symbol* DeclareSymbol(Symbol* symbol, char* name, char* type, char* kind, ParserInfo pi, int createSubScope);
+Symbol* DeclareSymbol(Symbol* symbol, char* name, char* type, SymbolKind kind, ParserInfo pi, int createSubScope);
 ParserInfo ClassDeclar();
 ParserInfo MemberDeclar();
 ParserInfo ClassVarDeclar();
@@ -44,6 +44,9 @@ ParserInfo OperantIdentifier();
 
 extern bool secondPass;
 
+// Ordinal of the last token consumed in the current file, the first pass records resolved symbols under it
+int tokenOrdinal = 0;
+
 // This code was taken from bing chat
 void safe_snprintf(char *buffer, size_t bufferSize, const char *format, ...) 
 {
@@ -81,6 +84,7 @@ static void PrintErrorCombine(char* errorMessage, ParserInfo* parserInfo)
 Token GetNextTokenWithErrorCheck(ParserInfo *pi)
 {
     Token t = GetNextToken();
+	tokenOrdinal++;
 
     if (t.tp == ERR)
     {
@@ -103,7 +107,7 @@ Token PeekNextTokenWithErrorCheck(ParserInfo *pi)
 	return t;
 }
 
-Symbol* DeclareSymbol(Symbol* symbol, char* name, char* type, char* kind, ParserInfo pi, int createSubScope)
+Symbol* DeclareSymbol(Symbol* symbol, char* name, char* type, SymbolKind kind, ParserInfo pi, int createSubScope)
 {
 	if (symbol == NULL)
 	{
@@ -114,23 +118,18 @@ Symbol* DeclareSymbol(Symbol* symbol, char* name, char* type, char* kind, Parser
 	
 	if (IsUndeclearedSymbol(symbol))
 	{
-		strcpy(symbol->type, type);
-		strcpy(symbol->kind, kind);
-		symbol->address = GetSymbolAddress(symbol);
-		symbol->pi = pi;
+		ResolveSymbol(symbol, type, kind, pi);
 		return symbol;
 	}
 
-	// Return symbol on second pass to not confuse with undeclared symbol
-	if(secondPass == true)
-		return symbol;
-
 	return NULL;
 }
 
 int InitParser (char* file_name)
 {
 	InitLexer(file_name);
+	SelectReferenceFile(file_name);
+	tokenOrdinal = 0;
 	return 1;
 }
 
@@ -171,14 +170,19 @@ ParserInfo ClassDeclar()
 		return pi;
 	}
 
-	// Create a scope for this class
-	Symbol* classSymbol = SearchSymbolFromCurrentScope(t.lx);
-	classSymbol = DeclareSymbol(classSymbol, t.lx, t.lx, "class", pi, 1);
+	Symbol* classSymbol = NULL;
 
-	if(classSymbol == NULL)
+	if (secondPass == false)
 	{
-		Error(&pi, &t, redecIdentifier, "class name already exists");
-		return pi;
+		// Create a scope for this class
+		classSymbol = SearchSymbolFromCurrentScope(t.lx);
+		classSymbol = DeclareSymbol(classSymbol, t.lx, t.lx, KIND_CLASS, pi, 1);
+
+		if(classSymbol == NULL)
+		{
+			Error(&pi, &t, redecIdentifier, "class name already exists");
+			return pi;
+		}
 	}
 
 	NEXT_TOKEN
@@ -190,8 +194,9 @@ ParserInfo ClassDeclar()
 		return pi;
 	}
 
-	// Enter class scope
-	EnterScope(classSymbol);
+	// Enter class scope, the second pass does not look symbols up by scope
+	if (secondPass == false)
+		EnterScope(classSymbol);
 
 	PEEK_TOKEN
 
@@ -216,7 +221,8 @@ ParserInfo ClassDeclar()
 		return pi;
 	}
 
-	ExitScope();
+	if (secondPass == false)
+		ExitScope();
 
 	return pi;
 }
@@ -267,8 +273,7 @@ ParserInfo ClassVarDeclar()
 	NEXT_TOKEN
 
 	// Store kind of variable
-	char kind[128];
-	strcpy(kind, t.lx);
+	SymbolKind kind = GetKindFromKeyword(t.lx);
 
 	// Check if static or field is found
 	if(t.tp != RESWORD || ((strcmp(t.lx, "static") != 0 && strcmp(t.lx, "field") != 0)))
@@ -295,13 +300,18 @@ ParserInfo ClassVarDeclar()
 		return pi;
 	}
 
-	Symbol* symbol = SearchSymbolFromCurrentScope(t.lx);
-	symbol = DeclareSymbol(symbol, t.lx, type, kind, pi, 0);
+	Symbol* symbol;
 
-	if(symbol == NULL)
+	if (secondPass == false)
 	{
-		Error(&pi, &t, redecIdentifier, "variable name already exists");
-		return pi;
+		symbol = SearchSymbolFromCurrentScope(t.lx);
+		symbol = DeclareSymbol(symbol, t.lx, type, kind, pi, 0);
+
+		if(symbol == NULL)
+		{
+			Error(&pi, &t, redecIdentifier, "variable name already exists");
+			return pi;
+		}
 	}
 
 	NEXT_TOKEN
@@ -318,14 +328,16 @@ ParserInfo ClassVarDeclar()
 			return pi;
 		}
 
-		// Check if identifier is found
-		symbol = SearchSymbolFromCurrentScope(t.lx);
-		symbol = DeclareSymbol(symbol, t.lx, type, kind, pi, 0);
-
-		if(symbol == NULL)
+		if (secondPass == false)
 		{
-			Error(&pi, &t, redecIdentifier, "variable name already exists");
-			return pi;
+			symbol = SearchSymbolFromCurrentScope(t.lx);
+			symbol = DeclareSymbol(symbol, t.lx, type, kind, pi, 0);
+
+			if(symbol == NULL)
+			{
+				Error(&pi, &t, redecIdentifier, "variable name already exists");
+				return pi;
+			}
 		}
 
 		NEXT_TOKEN
@@ -367,14 +379,14 @@ ParserInfo Type()
 	}
 
 	// If type is identifier, then it's a class name
-	if (t.tp == ID)
+	if (t.tp == ID && secondPass == false)
 	{
 		Scope* classScope = FindClass(t.lx);
 
 		if (classScope == NULL)
 		{
 			//Create undeclared class
-			CreateClass(t.lx, t.lx, "NULL", pi);
+			CreateClass(t.lx, t.lx, KIND_NULL, pi);
 		}
 	}
 
@@ -401,8 +413,7 @@ ParserInfo SubroutineDeclar()
 		return pi;
 	}
 
-	char kind[128];
-	strcpy(kind, t.lx);
+	SymbolKind kind = GetKindFromKeyword(t.lx);
 
 	PEEK_TOKEN
 
@@ -437,27 +448,35 @@ ParserInfo SubroutineDeclar()
 		return pi;
 	}
 	
-	// Find the symbol in the current scope
-	Symbol* symbol = SearchSymbolFromCurrentScope(t.lx);
-	symbol = DeclareSymbol(symbol, t.lx, type, kind, pi, 1);
+	Symbol* symbol = NULL;
 
-	if(symbol == NULL)
+	if (secondPass == false)
 	{
-		char errorMsg[128];
-		safe_snprintf(errorMsg, sizeof(errorMsg), "subroutine (%s) already exists", t.lx);
+		// Find the symbol in the current scope
+		symbol = SearchSymbolFromCurrentScope(t.lx);
+		symbol = DeclareSymbol(symbol, t.lx, type, kind, pi, 1);
 
-		Error(&pi, &t, redecIdentifier, errorMsg);
-		return pi;
-	}
+		if(symbol == NULL)
+		{
+			char errorMsg[128];
+			safe_snprintf(errorMsg, sizeof(errorMsg), "subroutine (%s) already exists", t.lx);
 
-	if(secondPass == true)
+			Error(&pi, &t, redecIdentifier, errorMsg);
+			return pi;
+		}
+
+		RecordReference(tokenOrdinal, symbol);
+	}
+	else
 	{
-		if(strcmp(kind, "method") == 0)
-			EmitMethod(symbol);
-		else if (strcmp(kind, "constructor") == 0)
-			EmitConstructor(symbol);
-		else if (strcmp(kind, "function") == 0)
-			EmitFunction1(symbol);
+		SymbolId symbolId = GetReference(tokenOrdinal);
+
+		if(kind == KIND_METHOD)
+			EmitMethod(symbolId);
+		else if (kind == KIND_CONSTRUCTOR)
+			EmitConstructor(symbolId);
+		else if (kind == KIND_FUNCTION)
+			EmitFunction1(symbolId);
 	}
 		
 
@@ -470,7 +489,8 @@ ParserInfo SubroutineDeclar()
 		return pi;
 	}
 
-	EnterScope(symbol);
+	if (secondPass == false)
+		EnterScope(symbol);
 
 	pi = ParamList();
 
@@ -490,7 +510,8 @@ ParserInfo SubroutineDeclar()
 	if (pi.er != none)
 		return pi;
 
-	ExitScope();
+	if (secondPass == false)
+		ExitScope();
 
 	return pi;
 }
@@ -501,24 +522,20 @@ ParserInfo ParamList()
 	ParserInfo pi;
 	pi.er = none;
 
-	// Find the parent class, for type
-	Scope* classScope = FindParentClass();
-	//Create this symbol for method
-	char* name = classScope->scopeSymbol->name;
-	Scope* currentScope = GetCurrentScope();
-	Symbol* symbol;
-
-	// If current scope is not a function, then create "this" symbol
-	if (strcmp(currentScope->scopeSymbol->kind, "method") == 0)
+	if (secondPass == false)
 	{
-		if (secondPass == false)
-			symbol = CreateSymbolAtCurrentScope("this", name, "argument", pi, 0);
-	}
+		// Find the parent class, for type
+		Scope* classScope = FindParentClass();
+		//Create this symbol for method
+		char* name = classScope->scopeSymbol->name;
+		Scope* currentScope = GetCurrentScope();
 
-	if (strcmp(currentScope->scopeSymbol->kind, "constructor") == 0)
-	{
-		if (secondPass == false)
-			symbol = CreateSymbolAtCurrentScope("this", name, "THIS", pi, 0);
+		// If current scope is not a function, then create "this" symbol
+		if (currentScope->scopeSymbol->kind == KIND_METHOD)
+			CreateSymbolAtCurrentScope("this", name, KIND_ARGUMENT, pi, 0);
+
+		if (currentScope->scopeSymbol->kind == KIND_CONSTRUCTOR)
+			CreateSymbolAtCurrentScope("this", name, KIND_THIS, pi, 0);
 	}
 
 	PEEK_TOKEN
@@ -546,16 +563,16 @@ ParserInfo ParamList()
 	}
 
 	// add symbol to LOCAL subroutine scope
-	symbol = FindSymbolAtCurrentScope(t.lx);
-
-	if (symbol != NULL && secondPass == false)
+	if (secondPass == false)
 	{
-		Error(&pi, &t, redecIdentifier, "parameter already exists");
-		return pi;
-	}
+		if (FindSymbolAtCurrentScope(t.lx) != NULL)
+		{
+			Error(&pi, &t, redecIdentifier, "parameter already exists");
+			return pi;
+		}
 
-	if (secondPass == false)
-		CreateSymbolAtCurrentScope(t.lx, type, "argument", pi, 0);
+		CreateSymbolAtCurrentScope(t.lx, type, KIND_ARGUMENT, pi, 0);
+	}
 
 	PEEK_TOKEN
 
@@ -582,16 +599,16 @@ ParserInfo ParamList()
 			return pi;
 		}
 
-		symbol = FindSymbolAtCurrentScope(t.lx);
-
-		if (symbol != NULL && secondPass == false)
+		if (secondPass == false)
 		{
-			Error(&pi, &t, redecIdentifier, "parameter already exists");
-			return pi;
-		}
+			if (FindSymbolAtCurrentScope(t.lx) != NULL)
+			{
+				Error(&pi, &t, redecIdentifier, "parameter already exists");
+				return pi;
+			}
 
-		if (secondPass == false)
-			CreateSymbolAtCurrentScope(t.lx, type, "argument", pi, 0);
+			CreateSymbolAtCurrentScope(t.lx, type, KIND_ARGUMENT, pi, 0);
+		}
 
 		PEEK_TOKEN
 
@@ -748,14 +765,14 @@ ParserInfo VarDeclarStatement()
 		return pi;
 	}
 
-	if (FindSymbolAtCurrentScope(t.lx) != NULL && secondPass == false)
+	if (secondPass == false && FindSymbolAtCurrentScope(t.lx) != NULL)
 	{
 		Error(&pi, &t, redecIdentifier, "variable already exists");
 		return pi;
 	}
 
 	if (secondPass == false)
-		CreateSymbolAtCurrentScope(t.lx, type, "var", pi, 0);
+		CreateSymbolAtCurrentScope(t.lx, type, KIND_VAR, pi, 0);
 
 	PEEK_TOKEN
 
@@ -775,14 +792,14 @@ ParserInfo VarDeclarStatement()
 			return pi;
 		}
 
-		if (SearchSymbolFromCurrentScope(t.lx) != NULL && secondPass == false)
+		if (secondPass == false && SearchSymbolFromCurrentScope(t.lx) != NULL)
 		{
 			Error(&pi, &t, redecIdentifier, "variable already exists");
 			return pi;
 		}
 
 		if(secondPass == false)
-			CreateSymbolAtCurrentScope(t.lx, type, "var", pi, 0);
+			CreateSymbolAtCurrentScope(t.lx, type, KIND_VAR, pi, 0);
 
 		PEEK_TOKEN
 	}
@@ -823,17 +840,28 @@ ParserInfo LetStatement()
 		return pi;
 	}
 
-	Symbol* letVar = SearchSymbolFromCurrentScope(t.lx);
+	SymbolId letVar = NO_SYMBOL;
 	bool letArray = false;
 
-	// Check if symbol is in symbol table
-	if(letVar == NULL)
+	if (secondPass == true)
+	{
+		letVar = GetReference(tokenOrdinal);
+	}
+	else
 	{
-		char errorMsg[128];
-		safe_snprintf(errorMsg, sizeof(errorMsg), "variable (%s) not declared", t.lx);
+		Symbol* symbol = SearchSymbolFromCurrentScope(t.lx);
 
-		Error(&pi, &t, undecIdentifier, errorMsg);
-		return pi;
+		// Check if symbol is in symbol table
+		if(symbol == NULL)
+		{
+			char errorMsg[128];
+			safe_snprintf(errorMsg, sizeof(errorMsg), "variable (%s) not declared", t.lx);
+
+			Error(&pi, &t, undecIdentifier, errorMsg);
+			return pi;
+		}
+
+		RecordReference(tokenOrdinal, symbol);
 	}
 
 	PEEK_TOKEN
@@ -864,8 +892,8 @@ ParserInfo LetStatement()
 
 		if (secondPass)
 		{
-			EmitPushLocal(letVar->address);
-			EmitCode("add\n");
+			EmitPushLocal(frozenTable.addresses[letVar]);
+			EmitOperation(OP_ADD);
 		}
 	}
 
@@ -895,7 +923,7 @@ ParserInfo LetStatement()
 	if(secondPass == true)
 	{
 		if(letArray)
-			EmitLetArray(letVar->address);
+			EmitLetArray(frozenTable.addresses[letVar]);
 		else
 			EmitPop(letVar);
 	}
@@ -1148,7 +1176,9 @@ ParserInfo SubroutineCall()
 
 	Symbol* subroutineSymbol = NULL;
 	Symbol* subroutineCaller = NULL;
-	Scope* classScope;
+	SymbolId subroutineId = NO_SYMBOL;
+	SymbolId callerId = NO_SYMBOL;
+	Scope* classScope = NULL;
 
 	// Check if next token is .
 	if (t.tp == SYMBOL && strcmp(t.lx, ".") == 0)
@@ -1156,23 +1186,34 @@ ParserInfo SubroutineCall()
 		//If next token is . then the identifier is a class name or variable name that references a class
 		char name[128];
 		strcpy(name, identifier);
-		subroutineCaller = SearchSymbolFromCurrentScope(name);
-		
-		// If symbol is not found then create a class
-		if (subroutineCaller == NULL)
+
+		if (secondPass == true)
 		{
-			// Create undecleared class
-			classScope = CreateClass(name, name, "NULL", pi);
+			callerId = GetReference(tokenOrdinal);
 		}
 		else
 		{
-			classScope = FindClass(subroutineCaller->type);
-
-			if (classScope == NULL)
+			subroutineCaller = SearchSymbolFromCurrentScope(name);
+			
+			// If symbol is not found then create a class
+			if (subroutineCaller == NULL)
 			{
-				Error(&pi, &t, syntaxError, "variable does not reference a class");
-				return pi;
+				// Create undecleared class
+				classScope = CreateClass(name, name, KIND_NULL, pi);
+				subroutineCaller = classScope->scopeSymbol;
+			}
+			else
+			{
+				classScope = FindTypeClass(subroutineCaller);
+
+				if (classScope == NULL)
+				{
+					Error(&pi, &t, syntaxError, "variable does not reference a class");
+					return pi;
+				}
 			}
+
+			RecordReference(tokenOrdinal, subroutineCaller);
 		}
 
 		// Skip "." token
@@ -1187,15 +1228,28 @@ ParserInfo SubroutineCall()
 			return pi;
 		}
 
-		subroutineSymbol = SearchGlobalSymbol(classScope->scopeSymbol->name, t.lx);
-
-		// Check if subroutine is declared
-		if (subroutineSymbol == NULL)
+		if (secondPass == true)
 		{
-			// Create undecleared subroutine
-			CreateSymbolAtScope(classScope, t.lx, "NULL", "NULL", pi, 1);
+			subroutineId = GetReference(tokenOrdinal);
+		}
+		else
+		{
+			subroutineSymbol = SearchGlobalSymbol(classScope->scopeSymbol->name, t.lx);
+
+			// Check if subroutine is declared
+			if (subroutineSymbol == NULL)
+			{
+				// Create undecleared subroutine
+				subroutineSymbol = CreateSymbolAtScope(classScope, t.lx, "NULL", KIND_NULL, pi, 1);
+			}
+
+			RecordReference(tokenOrdinal, subroutineSymbol);
 		}
 	}
+	else if (secondPass == true)
+	{
+		subroutineId = GetReference(tokenOrdinal);
+	}
 	else
 	{
 		// If next token is not . then the identifier is a subroutine name
@@ -1211,8 +1265,10 @@ ParserInfo SubroutineCall()
 			}		
 
 			// Create undecleared subroutine
-			CreateSymbolAtScope(classScope, identifier, "NULL", "NULL", pi, 1);	
+			subroutineSymbol = CreateSymbolAtScope(classScope, identifier, "NULL", KIND_NULL, pi, 1);	
 		}	
+
+		RecordReference(tokenOrdinal, subroutineSymbol);
 	}
 
 	NEXT_TOKEN
@@ -1225,7 +1281,7 @@ ParserInfo SubroutineCall()
 	}
 	
 	if(secondPass == true)
-		EmitCaller(subroutineCaller);
+		EmitCaller(callerId);
 
 	pi = ExpressionList();
 
@@ -1242,7 +1298,7 @@ ParserInfo SubroutineCall()
 	}
 
 	if(secondPass == true)
-		EmitCall1(subroutineSymbol);
+		EmitCall1(subroutineId);
 
 	return pi;
 }
@@ -1360,9 +1416,9 @@ ParserInfo Expression()
 		if (secondPass == true)
 		{
 			if(strcmp(op, "|") == 0)
-				EmitCode("or\n");
+				EmitOperation(OP_OR);
 			else
-				EmitCode("and\n");
+				EmitOperation(OP_AND);
 		}
 	}
 
@@ -1401,11 +1457,11 @@ ParserInfo RelationalExpression()
 		if (secondPass == true)
 		{
 			if(strcmp(op, "<") == 0)
-				EmitCode("lt\n");
+				EmitOperation(OP_LT);
 			else if(strcmp(op, ">") == 0)
-				EmitCode("gt\n");
+				EmitOperation(OP_GT);
 			else if(strcmp(op, "=") == 0)
-				EmitCode("eq\n");
+				EmitOperation(OP_EQ);
 		}
 	}
 
@@ -1444,9 +1500,9 @@ ParserInfo ArithmeticExpression()
 		if (secondPass == true)
 		{
 			if(strcmp(op, "+") == 0)
-				EmitCode("add\n");
+				EmitOperation(OP_ADD);
 			else if(strcmp(op, "-") == 0)
-				EmitCode("sub\n");
+				EmitOperation(OP_SUB);
 		}
 	}
 	
@@ -1524,9 +1580,9 @@ ParserInfo Factor()
 	if (secondPass)
 	{
 		if(strcmp(op, "-") == 0)
-			EmitCode("neg\n");
+			EmitOperation(OP_NEG);
 		else if(strcmp(op, "~") == 0)
-			EmitCode("not\n");
+			EmitOperation(OP_NOT);
 	}
 	
 	return pi;
@@ -1606,7 +1662,7 @@ ParserInfo Operand()
 		if(secondPass)
 		{
 			EmitPushConstant(0);
-			EmitCode("not\n");
+			EmitOperation(OP_NOT);
 		}
 
 		NEXT_TOKEN
@@ -1617,16 +1673,14 @@ ParserInfo Operand()
 		// Skip "this" token
 		NEXT_TOKEN
 
-		Symbol* s = SearchSymbolFromCurrentScope(t.lx);
-
-		if (s == NULL)
+		if (secondPass == false && SearchSymbolFromCurrentScope(t.lx) == NULL)
 		{
 			Error(&pi, &t, undecIdentifier, "Identifier not declared");
 			return pi;
 		}
 
 		if(secondPass)
-			EmitCode("push pointer 0\n");
+			EmitPushSegment(SEG_POINTER, 0);
 	}
 	else
 	{
@@ -1660,6 +1714,8 @@ ParserInfo OperantIdentifier()
 
 	Symbol* idSymbol = NULL;
 	Symbol* caller = NULL;
+	SymbolId symbolId = NO_SYMBOL;
+	SymbolId callerId = NO_SYMBOL;
 	Scope* classScope = NULL;
 
 	//if nex token is "." then next token should be identifier
@@ -1668,23 +1724,34 @@ ParserInfo OperantIdentifier()
 		//If next token is . then the identifier is a class name or variable name that references a class
 		char name[128];
 		strcpy(name, identifier);
-		caller = SearchSymbolFromCurrentScope(name);
-		
-		// If symbol is not found then create a class
-		if (caller == NULL)
+
+		if (secondPass == true)
 		{
-			// Create undecleared class
-			classScope = CreateClass(name, name, "NULL", pi);
+			callerId = GetReference(tokenOrdinal);
 		}
 		else
 		{
-			classScope = FindClass(caller->type);
-
-			if (classScope == NULL)
+			caller = SearchSymbolFromCurrentScope(name);
+			
+			// If symbol is not found then create a class
+			if (caller == NULL)
 			{
-				Error(&pi, &t, syntaxError, "variable does not reference a class");
-				return pi;
+				// Create undecleared class
+				classScope = CreateClass(name, name, KIND_NULL, pi);
+				caller = classScope->scopeSymbol;
 			}
+			else
+			{
+				classScope = FindTypeClass(caller);
+
+				if (classScope == NULL)
+				{
+					Error(&pi, &t, syntaxError, "variable does not reference a class");
+					return pi;
+				}
+			}
+
+			RecordReference(tokenOrdinal, caller);
 		}
 
 		// Skip . token
@@ -1699,18 +1766,31 @@ ParserInfo OperantIdentifier()
 			return pi;
 		}
 
-		// Check if subroutine is declared
-		idSymbol = SearchGlobalSymbol(classScope->scopeSymbol->name, t.lx);
-
-		if (idSymbol == NULL)
+		if (secondPass == true)
 		{
-			// Create undecleared subroutine
-			CreateSymbolAtScope(classScope, t.lx, "NULL", "NULL", pi, 1);
+			symbolId = GetReference(tokenOrdinal);
+		}
+		else
+		{
+			// Check if subroutine is declared
+			idSymbol = SearchGlobalSymbol(classScope->scopeSymbol->name, t.lx);
+
+			if (idSymbol == NULL)
+			{
+				// Create undecleared subroutine
+				idSymbol = CreateSymbolAtScope(classScope, t.lx, "NULL", KIND_NULL, pi, 1);
+			}
+
+			RecordReference(tokenOrdinal, idSymbol);
 		}
 
 		// Peek to prepare for next iteration
 		PEEK_TOKEN
 	}
+	else if (secondPass == true)
+	{
+		symbolId = GetReference(tokenOrdinal);
+	}
 	else
 	{
 		// If next token is not . then the identifier is a subroutine name
@@ -1728,8 +1808,10 @@ ParserInfo OperantIdentifier()
 			}
 
 			// Create undecleared subroutine
-			CreateSymbolAtScope(classScope, identifier, "NULL", "NULL", pi, 1);
+			idSymbol = CreateSymbolAtScope(classScope, identifier, "NULL", KIND_NULL, pi, 1);
 		}
+
+		RecordReference(tokenOrdinal, idSymbol);
 	}
 
 	//if next token is [
@@ -1754,7 +1836,7 @@ ParserInfo OperantIdentifier()
 
 		if(secondPass)
 		{
-			EmitAccessArray(idSymbol->address);
+			EmitAccessArray(frozenTable.addresses[symbolId]);
 		}
 	}
 	// if next token is (
@@ -1764,7 +1846,7 @@ ParserInfo OperantIdentifier()
 		NEXT_TOKEN
 
 		if(secondPass)
-			EmitCaller(caller);
+			EmitCaller(callerId);
 
 		pi = ExpressionList();
 
@@ -1781,12 +1863,12 @@ ParserInfo OperantIdentifier()
 		}
 
 		if(secondPass)
-			EmitCall1(idSymbol);
+			EmitCall1(symbolId);
 	}
 	else
 	{
 		if (secondPass)
-			EmitPush(idSymbol);
+			EmitPush(symbolId);
 	}
 	
 	return pi;
@@ -18,24 +18,97 @@ Date Work Commenced: 2022-04-05
 #include "symbols.h"
 #include "parser.h"
 
+void* ArenaAlloc(size_t size);
+void FreeArena();
+Symbol* AllocSymbol(Scope* scope);
+void AddPendingSymbol(Symbol* symbol);
+int GetFileId(char* fileName);
+SourceLocation GetSourceLocation(ParserInfo pi);
+void RemovePendingSymbol(Symbol* symbol);
 Scope* CreateScope(Symbol* scopeSymbol, Scope* parentScope);
+SymbolType GetTypeFromName(char* type);
+char* GetTypeName(SymbolType type);
+unsigned int HashName(char* name);
+void GrowScope(Scope* scope);
+void InsertSymbolIndex(Scope* scope, int index);
 void AddSymbol(Scope* scope, Symbol* symbol);
-Symbol* CreateSymbol(char* name, char* type, char* kind, Scope* parentScope, ParserInfo pi, int createSubScope);
+Symbol* CreateSymbol(char* name, char* type, SymbolKind kind, Scope* parentScope, ParserInfo pi, int createSubScope);
 Symbol* FindSymbolAtScope(Scope* scope, char* name);
+Symbol* FindSymbolWithHash(Scope* scope, char* name, unsigned int hash);
+void RegisterClass(Symbol* classSymbol);
+Symbol* LookupClass(char* className, unsigned int hash);
 void PrintScopeTabs(int scopeLevel);
 void PrintSymbol(Symbol* symbol);
 void PrintScope(Scope* scope);
-void FreeScope(Scope* scope);
+void FreezeScope(Scope* scope, SymbolId parent, char** nameCursor);
 
+// Symbol table nodes are carved from large slabs and released all at once
+#define SLAB_SIZE (256 * 1024)
+#define ARENA_ALIGN 16
+#define MAX_SYMBOL_BLOCK 64
+
+typedef struct Slab Slab;
+
+struct Slab
+{
+    Slab* next;
+    size_t used;
+    size_t size;
+};
+
+#define SLAB_HEADER ((sizeof(Slab) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+Slab* slabs = NULL;
 Scope* programScope = NULL;
 Scope* currentScope = NULL;
 
+// Names of the files symbols were declared in, SourceLocation refers to them by index
+char** fileNames = NULL;
+int fileCount = 0;
+
+// Symbols the first pass resolved at each token of a file, so the second pass does not search again
+typedef struct
+{
+    Symbol** symbols;   // indexed by token ordinal, NULL where nothing was recorded
+    SymbolId* ids;      // the same references as frozen symbol ids, filled by FreezeSymbolTable
+    int capacity;
+} ReferenceTable;
+
+ReferenceTable* referenceTables = NULL;
+int referenceTableCount = 0;
+int referenceFileId = -1;
+
+// Class directory, an open addressing table from class name to class symbol kept apart from the program scope
+typedef struct
+{
+    unsigned int hash;
+    Symbol* classSymbol;    // NULL marks an empty slot
+} ClassEntry;
+
+ClassEntry* classDirectory = NULL;
+int classDirectorySize = 0;
+int classCount = 0;
+
+// Flat copy of the symbol table the second pass reads, built by FreezeSymbolTable
+FrozenSymbolTable frozenTable;
+int symbolCount = 0;
+int nameBytes = 0;
+
+// Undeclared placeholder symbols that still wait for their declaration
+Symbol** pendingSymbols = NULL;
+int pendingLength = 0;
+int pendingCapacity = 0;
+int pendingCreated = 0;
+
+static char* kindNames[KIND_COUNT] = {"NULL", "Program", "class", "static", "field", "constructor", "function", "method", "argument", "var", "THIS"};
+static char* typeNames[TYPE_CLASS] = {"NULL", "Program", "void", "int", "char", "boolean"};
+
 void InitSymbolTable()
 {
     ParserInfo pi;
-    Token token;
+    Token token = {0};
     pi.tk = token;
-    Symbol* programSymbol = CreateSymbol("Program", "Program", "Program", NULL, pi, 1);
+    Symbol* programSymbol = CreateSymbol("Program", "Program", KIND_PROGRAM, NULL, pi, 1);
     programScope = CreateScope(programSymbol, NULL);
     currentScope = programScope;
 }
@@ -45,11 +118,200 @@ Scope* GetCurrentScope()
     return currentScope;
 }
 
+/// @brief Bump allocates from the current slab, starting a new slab when it is full.
+void* ArenaAlloc(size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (slabs == NULL || slabs->used + size > slabs->size)
+    {
+        size_t slabSize = size > SLAB_SIZE ? size : SLAB_SIZE;
+        Slab* slab = (Slab*)malloc(SLAB_HEADER + slabSize);
+
+        if (slab == NULL)
+        {
+            printf("Error: out of memory for symbol table\n");
+            exit(1);
+        }
+
+        slab->used = 0;
+        slab->size = slabSize;
+
+        // Oversized requests get their own slab, the current one stays open
+        if (slabs != NULL && slabSize > SLAB_SIZE)
+        {
+            slab->next = slabs->next;
+            slabs->next = slab;
+        }
+        else
+        {
+            slab->next = slabs;
+            slabs = slab;
+        }
+
+        slab->used = size;
+        return (char*)slab + SLAB_HEADER;
+    }
+
+    void* memory = (char*)slabs + SLAB_HEADER + slabs->used;
+    slabs->used += size;
+    return memory;
+}
+
+void FreeArena()
+{
+    while (slabs != NULL)
+    {
+        Slab* next = slabs->next;
+        free(slabs);
+        slabs = next;
+    }
+}
+
+/// @brief Takes the next symbol from the scope's block so a scope's symbols sit next to each other in memory.
+Symbol* AllocSymbol(Scope* scope)
+{
+    if (scope == NULL)
+        return (Symbol*)ArenaAlloc(sizeof(Symbol));
+
+    if (scope->blockUsed == scope->blockSize)
+    {
+        scope->blockSize = scope->blockSize == 0 ? 4 : scope->blockSize * 2;
+
+        if (scope->blockSize > MAX_SYMBOL_BLOCK)
+            scope->blockSize = MAX_SYMBOL_BLOCK;
+
+        scope->symbolBlock = (Symbol*)ArenaAlloc(sizeof(Symbol) * scope->blockSize);
+        scope->blockUsed = 0;
+    }
+
+    return &scope->symbolBlock[scope->blockUsed++];
+}
+
+/// @brief Returns the index of the file name, adding it to the list the first time it is seen.
+int GetFileId(char* fileName)
+{
+    // Symbols arrive file by file, so the last file is almost always the one
+    if (fileCount > 0 && strcmp(fileNames[fileCount - 1], fileName) == 0)
+        return fileCount - 1;
+
+    for (int i = 0; i < fileCount; i++)
+    {
+        if (strcmp(fileNames[i], fileName) == 0)
+            return i;
+    }
+
+    fileNames = (char**)realloc(fileNames, sizeof(char*) * (fileCount + 1));
+    fileNames[fileCount] = (char*)ArenaAlloc(strlen(fileName) + 1);
+    strcpy(fileNames[fileCount], fileName);
+
+    return fileCount++;
+}
+
+/// @brief Keeps only the file and line of the token, the file name is stored once per file.
+SourceLocation GetSourceLocation(ParserInfo pi)
+{
+    SourceLocation location;
+    location.fileId = GetFileId(pi.tk.fl);
+    location.line = pi.tk.ln;
+
+    return location;
+}
+
+/// @brief Makes the file's reference table the one recorded into and read from.
+void SelectReferenceFile(char* fileName)
+{
+    referenceFileId = GetFileId(fileName);
+
+    if (referenceFileId >= referenceTableCount)
+    {
+        referenceTables = (ReferenceTable*)realloc(referenceTables, sizeof(ReferenceTable) * fileCount);
+        memset(referenceTables + referenceTableCount, 0, sizeof(ReferenceTable) * (fileCount - referenceTableCount));
+        referenceTableCount = fileCount;
+    }
+}
+
+void RecordReference(int tokenOrdinal, Symbol* symbol)
+{
+    ReferenceTable* table = &referenceTables[referenceFileId];
+
+    if (tokenOrdinal >= table->capacity)
+    {
+        int capacity = table->capacity == 0 ? 256 : table->capacity;
+
+        while (capacity <= tokenOrdinal)
+            capacity *= 2;
+
+        table->symbols = (Symbol**)realloc(table->symbols, sizeof(Symbol*) * capacity);
+        memset(table->symbols + table->capacity, 0, sizeof(Symbol*) * (capacity - table->capacity));
+        table->capacity = capacity;
+    }
+
+    table->symbols[tokenOrdinal] = symbol;
+}
+
+/// @brief Returns the frozen id of the symbol recorded at the token, only valid after FreezeSymbolTable.
+SymbolId GetReference(int tokenOrdinal)
+{
+    ReferenceTable* table = &referenceTables[referenceFileId];
+
+    if (tokenOrdinal >= table->capacity)
+        return NO_SYMBOL;
+
+    return table->ids[tokenOrdinal];
+}
+
+/// @brief Rebuilds the parser info of a symbol's location for diagnostics, the token lexeme is the symbol name.
+ParserInfo GetSymbolParserInfo(Symbol* symbol, SyntaxErrors error)
+{
+    ParserInfo pi;
+    pi.er = error;
+    pi.tk.tp = ID;
+    pi.tk.ec = 0;
+    pi.tk.ln = symbol->location.line;
+    snprintf(pi.tk.lx, sizeof(pi.tk.lx), "%s", symbol->name);
+    snprintf(pi.tk.fl, sizeof(pi.tk.fl), "%s", fileNames[symbol->location.fileId]);
+
+    return pi;
+}
+
+void AddPendingSymbol(Symbol* symbol)
+{
+    if (pendingLength == pendingCapacity)
+    {
+        pendingCapacity = pendingCapacity == 0 ? 64 : pendingCapacity * 2;
+        pendingSymbols = (Symbol**)realloc(pendingSymbols, sizeof(Symbol*) * pendingCapacity);
+    }
+
+    symbol->pendingIndex = pendingLength;
+    symbol->pendingNumber = pendingCreated++;
+    pendingSymbols[pendingLength++] = symbol;
+}
+
+/// @brief Removes a symbol from the pending list in O(1) by moving the last entry into its place.
+void RemovePendingSymbol(Symbol* symbol)
+{
+    Symbol* last = pendingSymbols[--pendingLength];
+
+    pendingSymbols[symbol->pendingIndex] = last;
+    last->pendingIndex = symbol->pendingIndex;
+    symbol->pendingIndex = -1;
+}
+
 Scope* CreateScope(Symbol* scopeSymbol, Scope* parentScope)
 {
-    Scope* scope = (Scope*)malloc(sizeof(Scope));
+    Scope* scope = (Scope*)ArenaAlloc(sizeof(Scope));
     scope->scopeSymbol = scopeSymbol;
     scope->length = 0;
+    scope->capacity = 8;
+    scope->symbols = (Symbol**)ArenaAlloc(sizeof(Symbol*) * scope->capacity);
+    scope->tableSize = 16;
+    scope->table = (int*)ArenaAlloc(sizeof(int) * scope->tableSize);
+    memset(scope->table, 0, sizeof(int) * scope->tableSize);
+    memset(scope->kindCounts, 0, sizeof(scope->kindCounts));
+    scope->symbolBlock = NULL;
+    scope->blockUsed = 0;
+    scope->blockSize = 0;
     scope->parentScope = parentScope;
 
     if(parentScope == NULL)
@@ -60,93 +322,204 @@ Scope* CreateScope(Symbol* scopeSymbol, Scope* parentScope)
     return scope;
 }
 
-int GetSymbolAddress(Symbol* symbol)
+/// @brief Maps a declaration keyword (static, field, constructor, ...) to its kind, anything else is KIND_NULL.
+SymbolKind GetKindFromKeyword(char* keyword)
 {
-    int count = 0;
-    Scope* scope = symbol->parentScope;
-
-    for (int i = 0; i < scope->length; i++)
+    for (int i = KIND_CLASS; i < KIND_THIS; i++)
     {
-        Symbol* s = scope->symbols[i];
+        if (strcmp(kindNames[i], keyword) == 0)
+            return (SymbolKind)i;
+    }
 
-        if (s == symbol)
-            continue;
+    return KIND_NULL;
+}
+
+/// @brief Maps a type name to a primitive type or a reference to an existing class symbol.
+SymbolType GetTypeFromName(char* type)
+{
+    SymbolType symbolType;
+    symbolType.classSymbol = NULL;
 
-        if (strcmp(scope->symbols[i]->kind, symbol->kind) == 0)
-            count++;
+    for (int i = 0; i < TYPE_CLASS; i++)
+    {
+        if (strcmp(typeNames[i], type) == 0)
+        {
+            symbolType.kind = (TypeKind)i;
+            return symbolType;
+        }
     }
 
-    return count;
+    symbolType.kind = TYPE_CLASS;
+
+    if (programScope != NULL)
+        symbolType.classSymbol = LookupClass(type, HashName(type));
+
+    return symbolType;
+}
+
+char* GetTypeName(SymbolType type)
+{
+    if (type.kind != TYPE_CLASS)
+        return typeNames[type.kind];
+
+    return type.classSymbol == NULL ? "NULL" : type.classSymbol->name;
 }
 
 int GetArgumentCount(Symbol* symbol)
 {
-    int count = 0;
+    return symbol->subScope->kindCounts[KIND_ARGUMENT];
+}
+
+int GetGlobalVarCount(Scope* classScope)
+{
+    return classScope->kindCounts[KIND_FIELD];
+}
+
+int GetLocalVarCount(Symbol* symbol)
+{
     Scope* scope = symbol->subScope;
 
-    for (int i = 0; i < scope->length; i++)
-    {
-        Symbol* s = scope->symbols[i];
+    return scope->kindCounts[KIND_VAR] + scope->kindCounts[KIND_FIELD] + scope->kindCounts[KIND_STATIC];
+}
 
-        if (strcmp(scope->symbols[i]->kind, "argument") == 0)
-            count++;
+/// @brief FNV-1a hash of a symbol name.
+unsigned int HashName(char* name)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*name != '\0')
+    {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
     }
 
-    return count;
+    return hash;
 }
 
-int GetGlobalVarCount(Scope* classScope)
+/// @brief Places the symbol at the given index into the first free slot of its probe sequence.
+void InsertSymbolIndex(Scope* scope, int index)
 {
-    int count = 0;
-    Scope* scope = classScope;
+    unsigned int mask = scope->tableSize - 1;
+    unsigned int slot = scope->symbols[index]->hash & mask;
+
+    while (scope->table[slot] != 0)
+        slot = (slot + 1) & mask;
+
+    scope->table[slot] = index + 1;
+}
+
+/// @brief Doubles the symbol array and the hash table, rehashing every symbol. The old arrays stay in the arena.
+void GrowScope(Scope* scope)
+{
+    Symbol** symbols = (Symbol**)ArenaAlloc(sizeof(Symbol*) * scope->capacity * 2);
+    memcpy(symbols, scope->symbols, sizeof(Symbol*) * scope->length);
+    scope->symbols = symbols;
+    scope->capacity *= 2;
+
+    scope->tableSize *= 2;
+    scope->table = (int*)ArenaAlloc(sizeof(int) * scope->tableSize);
+    memset(scope->table, 0, sizeof(int) * scope->tableSize);
 
     for (int i = 0; i < scope->length; i++)
+        InsertSymbolIndex(scope, i);
+}
+
+/// @brief Adds a class to the directory, doubling the table when it is half full. The first class of a name wins.
+void RegisterClass(Symbol* classSymbol)
+{
+    if (LookupClass(classSymbol->name, classSymbol->hash) != NULL)
+        return;
+
+    if ((classCount + 1) * 2 > classDirectorySize)
     {
-        Symbol* s = scope->symbols[i];
+        ClassEntry* entries = classDirectory;
+        int size = classDirectorySize;
+
+        classDirectorySize = size == 0 ? 64 : size * 2;
+        classDirectory = (ClassEntry*)ArenaAlloc(sizeof(ClassEntry) * classDirectorySize);
+        memset(classDirectory, 0, sizeof(ClassEntry) * classDirectorySize);
+        classCount = 0;
 
-        if (strcmp(scope->symbols[i]->kind, "field") == 0)
-            count++;
+        for (int i = 0; i < size; i++)
+        {
+            if (entries[i].classSymbol != NULL)
+                RegisterClass(entries[i].classSymbol);
+        }
     }
 
-    return count;
+    unsigned int mask = classDirectorySize - 1;
+    unsigned int slot = classSymbol->hash & mask;
+
+    while (classDirectory[slot].classSymbol != NULL)
+        slot = (slot + 1) & mask;
+
+    classDirectory[slot].hash = classSymbol->hash;
+    classDirectory[slot].classSymbol = classSymbol;
+    classCount++;
 }
 
-int GetLocalVarCount(Symbol* symbol)
+/// @brief Returns the class symbol with the given name from the directory, NULL if there is none.
+Symbol* LookupClass(char* className, unsigned int hash)
 {
-    int count = 0;
-    Scope* scope = symbol->subScope;
+    if (classDirectory == NULL)
+        return NULL;
 
-    for (int i = 0; i < scope->length; i++)
+    unsigned int mask = classDirectorySize - 1;
+    unsigned int slot = hash & mask;
+
+    while (classDirectory[slot].classSymbol != NULL)
     {
-        Symbol* s = scope->symbols[i];
+        Symbol* classSymbol = classDirectory[slot].classSymbol;
+
+        if (classDirectory[slot].hash == hash && strcmp(classSymbol->name, className) == 0)
+            return classSymbol;
 
-        if (strcmp(scope->symbols[i]->kind, "var") == 0 || strcmp(scope->symbols[i]->kind, "field") == 0 || strcmp(scope->symbols[i]->kind, "static") == 0)
-            count++;
+        slot = (slot + 1) & mask;
     }
 
-    return count;
+    return NULL;
 }
 
 void AddSymbol(Scope* scope, Symbol* symbol)
 {
-    // Assign address
+    // Assign address, the next free slot of this kind
     symbol->parentScope = scope;
-    int address = GetSymbolAddress(symbol);
-    symbol->address = address;
+    symbol->address = scope->kindCounts[symbol->kind]++;
+
+    if (scope->length == scope->capacity)
+        GrowScope(scope);
 
     // Add symbol to scope
     scope->symbols[scope->length] = symbol;
+    InsertSymbolIndex(scope, scope->length);
     scope->length++;
+    symbolCount++;
+    nameBytes += strlen(symbol->name) + 1;
+
+    // Classes are created by CreateClass and declared by the parser, both end up here
+    if (scope == programScope)
+        RegisterClass(symbol);
 }
 
-Symbol* CreateSymbol(char* name, char* type, char* kind, Scope* parentScope, ParserInfo pi, int createSubScope)
+Symbol* CreateSymbol(char* name, char* type, SymbolKind kind, Scope* parentScope, ParserInfo pi, int createSubScope)
 {
-    Symbol* symbol = (Symbol*)malloc(sizeof(Symbol));
+    Symbol* symbol = AllocSymbol(parentScope);
+    symbol->name = (char*)ArenaAlloc(strlen(name) + 1);
     strcpy(symbol->name, name);
-    strcpy(symbol->type, type);
-    strcpy(symbol->kind, kind);
+    symbol->type = GetTypeFromName(type);
+    symbol->kind = kind;
+    symbol->hash = HashName(name);
+
+    // A class is the type of its own symbol, and is not in the program scope yet
+    if (symbol->type.kind == TYPE_CLASS && symbol->type.classSymbol == NULL && strcmp(name, type) == 0)
+        symbol->type.classSymbol = symbol;
+
     symbol->subScope = NULL;
-    symbol->pi = pi;
+    symbol->location = GetSourceLocation(pi);
+    symbol->pendingIndex = -1;
+
+    if (IsUndeclearedSymbol(symbol))
+        AddPendingSymbol(symbol);
 
     if (createSubScope == 1)
     {
@@ -156,35 +529,63 @@ Symbol* CreateSymbol(char* name, char* type, char* kind, Scope* parentScope, Par
     return symbol;
 }
 
-Scope* CreateClass(char* className, char* type, char* kind, ParserInfo pi)
+Scope* CreateClass(char* className, char* type, SymbolKind kind, ParserInfo pi)
 {
     Symbol* classSymbol = CreateSymbol(className, type, kind, programScope, pi, 1);
     AddSymbol(programScope, classSymbol);
     return classSymbol->subScope;
 }
 
-Symbol* CreateSymbolAtScope(Scope* scope, char* name, char* type, char* kind, ParserInfo pi, int createSubScope)
+Symbol* CreateSymbolAtScope(Scope* scope, char* name, char* type, SymbolKind kind, ParserInfo pi, int createSubScope)
 {
     Symbol* symbol = CreateSymbol(name, type, kind, scope, pi, createSubScope);
     AddSymbol(scope, symbol);
     return symbol;
 }
 
-Symbol* CreateSymbolAtCurrentScope(char* name, char* type, char* kind, ParserInfo pi, int createSubScope)
+Symbol* CreateSymbolAtCurrentScope(char* name, char* type, SymbolKind kind, ParserInfo pi, int createSubScope)
 {
     return CreateSymbolAtScope(currentScope, name, type, kind, pi, createSubScope);
 }
 
+/// @brief Gives an undeclared (placeholder) symbol its declared type and kind, moving it to the end of its new kind.
+void ResolveSymbol(Symbol* symbol, char* type, SymbolKind kind, ParserInfo pi)
+{
+    Scope* scope = symbol->parentScope;
+
+    scope->kindCounts[symbol->kind]--;
+
+    symbol->type = GetTypeFromName(type);
+    symbol->kind = kind;
+    symbol->address = scope->kindCounts[kind]++;
+    symbol->location = GetSourceLocation(pi);
+
+    if (symbol->pendingIndex >= 0 && !IsUndeclearedSymbol(symbol))
+        RemovePendingSymbol(symbol);
+}
+
 Symbol* FindSymbolAtScope(Scope* scope, char* name)
 {
-    for (int i = 0; i < scope->length; i++)
+    return FindSymbolWithHash(scope, name, HashName(name));
+}
+
+/// @brief Looks the name up in one scope with an already computed hash.
+Symbol* FindSymbolWithHash(Scope* scope, char* name, unsigned int hash)
+{
+    unsigned int mask = scope->tableSize - 1;
+    unsigned int slot = hash & mask;
+
+    // Probe until an empty slot, equal names are found in declaration order
+    while (scope->table[slot] != 0)
     {
-        Symbol* symbol = scope->symbols[i];
+        Symbol* symbol = scope->symbols[scope->table[slot] - 1];
 
-        if (strcmp(symbol->name, name) == 0)
+        if (symbol->hash == hash && strcmp(symbol->name, name) == 0)
         {
             return symbol;
         }
+
+        slot = (slot + 1) & mask;
     }
 
     return NULL;
@@ -197,19 +598,21 @@ Symbol* FindSymbolAtCurrentScope(char* name)
 
 Scope* FindClass(char* className)
 {
-    Scope* classScope = NULL;
+    Symbol* classSymbol = LookupClass(className, HashName(className));
 
-    for (int i = 0; i < programScope->length; i++)
-    {
-        Symbol* programSymbol = programScope->symbols[i];
+    if (classSymbol == NULL)
+        return NULL;
 
-        if (strcmp(programSymbol->name, className) == 0)
-        {
-            return programSymbol->subScope;
-        } 
-    }
+    return classSymbol->subScope;
+}
 
-    return NULL;
+/// @brief Returns the class scope of the symbol's type, NULL if the type is not a class.
+Scope* FindTypeClass(Symbol* symbol)
+{
+    if (symbol->type.kind != TYPE_CLASS || symbol->type.classSymbol == NULL)
+        return NULL;
+
+    return symbol->type.classSymbol->subScope;
 }
 
 Scope* FindParentClass()
@@ -230,58 +633,35 @@ Scope* FindParentClass()
 /// @brief Finds a symbol in the scope and all parent scopes.(Moves UP the tree) (BFS search)
 Symbol* SearchSymbolUp(Scope* startScope, char* name)
 {
-    if (startScope == NULL)
-        return NULL;
+    unsigned int hash = HashName(name);
 
-    for (int i = 0; i < startScope->length; i++)
+    // The name is hashed once and probed at every level
+    for (Scope* scope = startScope; scope != NULL; scope = scope->parentScope)
     {
-        Symbol* symbol = startScope->symbols[i];
+        Symbol* symbol = FindSymbolWithHash(scope, name, hash);
 
-        if (strcmp(symbol->name, name) == 0)
-        {
+        if (symbol != NULL)
             return symbol;
-        }
     }
 
-    Symbol* symbol = SearchSymbolUp(startScope->parentScope, name);
-
-    return symbol;
+    return NULL;
 }
 
-/// @brief Finds a symbol in the scope and all child scopes.(Moves DOWN the tree) (BFS search)
+/// @brief Returns an undeclared symbol that was never resolved, preferring the outermost one (classes before their members) and then the first one created.
 Symbol* SearchForUndeclaredSymbol()
 {
-    Scope* scopes[1000];
-    int head = 0;
-    int tail = 0;
+    Symbol* undeclared = NULL;
 
-    scopes[tail++] = programScope;
-
-    while (head < tail) 
+    for (int i = 0; i < pendingLength; i++)
     {
-        Scope* scope = scopes[head++];
-
-        for (int i = 0; i < scope->length; i++) 
-        {
-            Symbol* symbol = scope->symbols[i];
+        Symbol* symbol = pendingSymbols[i];
 
-            if (strcmp(symbol->type, "NULL") == 0 || strcmp(symbol->kind, "NULL") == 0)
-            {
-                symbol->pi.er = undecIdentifier;
-                return symbol;
-            }
-
-            if (symbol->subScope != NULL) 
-            {
-                if (tail >= 1000)
-                    return NULL;
-
-                scopes[tail++] = symbol->subScope;
-            }
-        }
+        if (undeclared == NULL || symbol->parentScope->scopeLevel < undeclared->parentScope->scopeLevel
+            || (symbol->parentScope->scopeLevel == undeclared->parentScope->scopeLevel && symbol->pendingNumber < undeclared->pendingNumber))
+            undeclared = symbol;
     }
 
-    return NULL;
+    return undeclared;
 }
 
 Symbol* SearchSymbolFromCurrentScope(char* name)
@@ -306,7 +686,7 @@ int IsUndeclearedSymbol(Symbol* symbol)
     if (symbol == NULL)
         return 1;
 
-    if (strcmp(symbol->type, "NULL") == 0 || strcmp(symbol->kind, "NULL") == 0)
+    if (symbol->type.kind == TYPE_NULL || symbol->kind == KIND_NULL)
         return 1;
 
     return 0;
@@ -346,13 +726,16 @@ void PrintSymbol(Symbol* symbol)
     Scope* subScope = symbol->subScope;
     char* subScopeName = subScope == NULL ? "NULL" : subScope->scopeSymbol->name;
 
-    if (strcmp(symbol->type, "NULL") == 0 || strcmp(symbol->kind, "NULL") == 0)
+    char* typeName = GetTypeName(symbol->type);
+    char* kindName = kindNames[symbol->kind];
+
+    if (IsUndeclearedSymbol(symbol))
     {
-        printf("(N: %s, T: %s, K: %s, A: %d, S: %s) <--- UNDECLARED\n", symbol->name, symbol->type, symbol->kind, symbol->address, subScopeName);
+        printf("(N: %s, T: %s, K: %s, A: %d, S: %s) <--- UNDECLARED\n", symbol->name, typeName, kindName, symbol->address, subScopeName);
         return;
     }
     
-    printf("(N: %s, T: %s, K: %s, A: %d, S: %s)\n", symbol->name, symbol->type, symbol->kind, symbol->address, subScopeName);
+    printf("(N: %s, T: %s, K: %s, A: %d, S: %s)\n", symbol->name, typeName, kindName, symbol->address, subScopeName);
 }
 
 void PrintScope(Scope* scope)
@@ -377,28 +760,121 @@ void PrintScope(Scope* scope)
     printf("}\n");
 }
 
-void PrintSymbolTable()
+/// @brief Gives every symbol of the scope and its sub scopes the next id, depth first, copying it into the frozen arrays.
+void FreezeScope(Scope* scope, SymbolId parent, char** nameCursor)
 {
-    PrintSymbol(programScope->scopeSymbol);
-    PrintScope(programScope);
+    for (int i = 0; i < scope->length; i++)
+    {
+        Symbol* symbol = scope->symbols[i];
+        SymbolId id = frozenTable.count++;
+
+        symbol->id = id;
+        strcpy(*nameCursor, symbol->name);
+        frozenTable.names[id] = *nameCursor;
+        *nameCursor += strlen(symbol->name) + 1;
+        frozenTable.kinds[id] = symbol->kind;
+        frozenTable.addresses[id] = symbol->address;
+        frozenTable.parents[id] = parent;
+        frozenTable.frameSizes[id] = 0;
+        frozenTable.argumentCounts[id] = 0;
+        frozenTable.staticCounts[id] = 0;
+
+        if (symbol->subScope == NULL)
+            continue;
+
+        if (symbol->kind == KIND_CLASS)
+        {
+            frozenTable.frameSizes[id] = GetGlobalVarCount(symbol->subScope);
+            frozenTable.staticCounts[id] = symbol->subScope->kindCounts[KIND_STATIC];
+        }
+        else
+            frozenTable.frameSizes[id] = GetLocalVarCount(symbol);
+
+        frozenTable.argumentCounts[id] = GetArgumentCount(symbol);
+
+        FreezeScope(symbol->subScope, id, nameCursor);
+    }
 }
 
-void FreeScope(Scope* scope)
+/// @brief Flattens the symbol table into parallel arrays and turns the recorded references into ids. Called once after the first pass.
+void FreezeSymbolTable()
 {
-    if (scope == NULL) 
-        return;
-
-    for (int i = 0; i < scope->length; i++) 
+    // One extra entry for the program symbol, id 0
+    int count = symbolCount + 1;
+    Symbol* programSymbol = programScope->scopeSymbol;
+
+    frozenTable.count = 0;
+    frozenTable.names = (char**)ArenaAlloc(sizeof(char*) * count);
+    frozenTable.kinds = (SymbolKind*)ArenaAlloc(sizeof(SymbolKind) * count);
+    frozenTable.addresses = (int*)ArenaAlloc(sizeof(int) * count);
+    frozenTable.parents = (SymbolId*)ArenaAlloc(sizeof(SymbolId) * count);
+    frozenTable.frameSizes = (int*)ArenaAlloc(sizeof(int) * count);
+    frozenTable.argumentCounts = (int*)ArenaAlloc(sizeof(int) * count);
+    frozenTable.staticCounts = (int*)ArenaAlloc(sizeof(int) * count);
+
+    char* nameCursor = (char*)ArenaAlloc(nameBytes + strlen(programSymbol->name) + 1);
+
+    programSymbol->id = frozenTable.count++;
+    strcpy(nameCursor, programSymbol->name);
+    frozenTable.names[0] = nameCursor;
+    nameCursor += strlen(programSymbol->name) + 1;
+    frozenTable.kinds[0] = programSymbol->kind;
+    frozenTable.addresses[0] = 0;
+    frozenTable.parents[0] = NO_SYMBOL;
+    frozenTable.frameSizes[0] = 0;
+    frozenTable.argumentCounts[0] = 0;
+    frozenTable.staticCounts[0] = 0;
+
+    FreezeScope(programScope, programSymbol->id, &nameCursor);
+
+    for (int i = 0; i < referenceTableCount; i++)
     {
-        Symbol* symbol = scope->symbols[i];
-        FreeScope(symbol->subScope);
-        free(symbol);
+        ReferenceTable* table = &referenceTables[i];
+
+        table->ids = (SymbolId*)malloc(sizeof(SymbolId) * table->capacity);
+
+        for (int j = 0; j < table->capacity; j++)
+            table->ids[j] = table->symbols[j] == NULL ? NO_SYMBOL : table->symbols[j]->id;
+
+        free(table->symbols);
+        table->symbols = NULL;
     }
-    
-    free(scope);
+}
+
+void PrintSymbolTable()
+{
+    PrintSymbol(programScope->scopeSymbol);
+    PrintScope(programScope);
 }
 
 void FreeSymbolTable()
 {
-    FreeScope(programScope);
+    FreeArena();
+    classDirectory = NULL;
+    classDirectorySize = 0;
+    classCount = 0;
+    memset(&frozenTable, 0, sizeof(frozenTable));
+    symbolCount = 0;
+    nameBytes = 0;
+
+    for (int i = 0; i < referenceTableCount; i++)
+    {
+        free(referenceTables[i].symbols);
+        free(referenceTables[i].ids);
+    }
+
+    free(referenceTables);
+    referenceTables = NULL;
+    referenceTableCount = 0;
+    referenceFileId = -1;
+    free(fileNames);
+    fileNames = NULL;
+    fileCount = 0;
+    free(pendingSymbols);
+    pendingSymbols = NULL;
+    pendingLength = 0;
+    pendingCapacity = 0;
+    pendingCreated = 0;
+    programScope = NULL;
+    currentScope = NULL;
 }
\ No newline at end of file
@@ -11,42 +11,121 @@
 // define your own types and function prototypes for the symbol table(s) module below
 
 typedef struct Scope Scope;
+typedef struct Symbol Symbol;
 
+// Index of a symbol in the frozen symbol table
+typedef int SymbolId;
+#define NO_SYMBOL -1
+
+typedef enum
+{
+    KIND_NULL,          // undeclared placeholder
+    KIND_PROGRAM,
+    KIND_CLASS,
+    KIND_STATIC,
+    KIND_FIELD,
+    KIND_CONSTRUCTOR,
+    KIND_FUNCTION,
+    KIND_METHOD,
+    KIND_ARGUMENT,
+    KIND_VAR,
+    KIND_THIS,          // "this" of a constructor
+    KIND_COUNT          // number of kinds, each scope keeps one counter per kind
+} SymbolKind;
+
+typedef enum
+{
+    TYPE_NULL,          // undeclared placeholder
+    TYPE_PROGRAM,
+    TYPE_VOID,
+    TYPE_INT,
+    TYPE_CHAR,
+    TYPE_BOOLEAN,
+    TYPE_CLASS          // instance of classSymbol
+} TypeKind;
+
+typedef struct
+{
+    TypeKind kind;
+    Symbol* classSymbol;
+} SymbolType;
+
+// Where a symbol was declared (or first referenced, for placeholders)
 typedef struct
 {
-    char name[128];
-    char type[32];
-    char kind[32];
+    int fileId;         // index into the symbol table's file name list
+    int line;
+} SourceLocation;
+
+struct Symbol
+{
+    char* name;
+    SymbolType type;
+    SymbolKind kind;
+    unsigned int hash;
     Scope* parentScope;
     Scope* subScope;
-    ParserInfo pi;
+    SourceLocation location;
     int address;
-} Symbol;
+    int pendingIndex;   // position in the undeclared symbol list, -1 once declared
+    int pendingNumber;  // order the undeclared symbols were created in, the list itself is not kept in order
+    SymbolId id;        // position in the frozen symbol table
+};
 
 struct Scope
 {
     Symbol* scopeSymbol;
-    Symbol* symbols[200];
+    Symbol** symbols;   // symbols in declaration order
     int length;
+    int capacity;
+    int* table;         // open addressing hash table of (symbol index + 1), 0 marks an empty slot
+    int tableSize;      // always a power of two, kept at most half full
+    int kindCounts[KIND_COUNT]; // number of symbols of each kind, next free address of that kind
+    Symbol* symbolBlock; // arena block the scope's next symbols are carved from
+    int blockUsed;
+    int blockSize;
     int scopeLevel;
     Scope* parentScope;
 };
 
+// The symbol table flattened after the first pass, one entry per symbol in each array.
+// The second pass reads symbols from here instead of following scope pointers.
+typedef struct
+{
+    int count;
+    char** names;           // point into one packed block of names
+    SymbolKind* kinds;
+    int* addresses;
+    SymbolId* parents;      // symbol of the enclosing scope, NO_SYMBOL for the program
+    int* frameSizes;        // local variables of a subroutine, fields of a class
+    int* argumentCounts;
+    int* staticCounts;      // statics of a class
+} FrozenSymbolTable;
+
+extern FrozenSymbolTable frozenTable;
+
 void InitSymbolTable();
-int GetSymbolAddress(Symbol* symbol);
 int GetArgumentCount(Symbol* symbol);
 int GetGlobalVarCount(Scope* classScope);
 int GetLocalVarCount(Symbol* symbol);
 Scope* GetCurrentScope();
-Scope* CreateClass(char* className, char* type, char* kind, ParserInfo pi);
-Symbol* CreateSymbolAtScope(Scope* scope, char* name, char* type, char* kind, ParserInfo pi, int createSubScope);
-Symbol* CreateSymbolAtCurrentScope(char* name, char* type, char* kind, ParserInfo pi, int createSubScope);
+Scope* CreateClass(char* className, char* type, SymbolKind kind, ParserInfo pi);
+Symbol* CreateSymbolAtScope(Scope* scope, char* name, char* type, SymbolKind kind, ParserInfo pi, int createSubScope);
+Symbol* CreateSymbolAtCurrentScope(char* name, char* type, SymbolKind kind, ParserInfo pi, int createSubScope);
+void ResolveSymbol(Symbol* symbol, char* type, SymbolKind kind, ParserInfo pi);
 Symbol* FindSymbolAtCurrentScope(char* name);
 Scope* FindClass(char* className);
+Scope* FindTypeClass(Symbol* symbol);
+SymbolKind GetKindFromKeyword(char* keyword);
 Scope* FindParentClass();
 Symbol* SearchSymbolFromCurrentScope(char* name);
 Symbol* SearchGlobalSymbol(char* className, char* name);
 Symbol* SearchForUndeclaredSymbol();
+ParserInfo GetSymbolParserInfo(Symbol* symbol, SyntaxErrors error);
+void SelectReferenceFile(char* fileName);
+void RecordReference(int tokenOrdinal, Symbol* symbol);
+SymbolId GetReference(int tokenOrdinal);
+void FreezeSymbolTable();
 int IsUndeclearedSymbol(Symbol* symbol);
 void ResetCurrentScope();
 void EnterScope(Symbol* symbol);
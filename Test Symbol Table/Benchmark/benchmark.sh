@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+# Scaling benchmark of the symbol table: compiles a generated class with
+# N/2 fields and N/2 methods, each method reading another field, for each N.
+# usage: ./benchmark.sh [path to compiler binary] [member counts...]
+# Build the compiler first, for example: cd Compiler && gcc -O2 *.c -o compiler
+
+here="$(cd "$(dirname "$0")" && pwd)"
+compiler="$(realpath "${1:-$here/../../Compiler/compiler}")"
+shift
+sizes=("$@")
+[ ${#sizes[@]} -eq 0 ] && sizes=(1000 2000 5000 10000 20000)
+
+work="$(mktemp -d)"
+trap 'rm -rf "$work"' EXIT
+cp "$here"/../*.jack "$work"/
+
+for n in "${sizes[@]}"; do
+	half=$((n / 2))
+	rm -rf "$work/Big"
+	mkdir "$work/Big"
+	awk -v half=$half 'BEGIN {
+		print "class Big {"
+		for (i = 0; i < half; i++) printf "    field int f%d;\n", i
+		for (i = 0; i < half; i++) printf "    method int m%d() { let f%d = f%d + 1; return f%d; }\n", i, i, (i * 7919) % half, i
+		print "}"
+	}' > "$work/Big/Big.jack"
+	echo "class Main { function void main() { var Big b; do b.m0(); return; } }" > "$work/Big/Main.jack"
+
+	start=$(date +%s%N)
+	(cd "$work" && "$compiler" Big > /dev/null)
+	end=$(date +%s%N)
+
+	if [ -f "$work/Big/Big.vm" ]; then
+		echo "$n members: $(((end - start) / 1000000)) ms"
+	else
+		echo "$n members: no Big.vm written"
+	fi
+done
@@ -10,7 +10,7 @@
 #define Presubmission 1
 
 // remove this before releasing template
-#define NumberTestFiles 20
+#define NumberTestFiles 21
 char* JsonStr;
 
 char* ErrorString (SyntaxErrors e);
@@ -41,6 +41,7 @@ char* testFiles[NumberTestFiles] = {
 	"Square3",
 	"ComplexArrays",
 	"Pong1",
+	"UNDECLAR_ORDER",
 };
 
 ParserInfo correctInfo [NumberTestFiles] = {
@@ -64,6 +65,7 @@ ParserInfo correctInfo [NumberTestFiles] = {
 	{undecIdentifier, {ID , "squar" , NoLexErr , 35} },
 	{none},
 	{undecIdentifier, {ID , "bas" , NoLexErr , 26} },
+	{undecIdentifier, {ID , "Foo" , NoLexErr , 4} },
 };
 
 int InitGraderString ()